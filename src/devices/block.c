@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/shutdown.h"
 #include "threads/malloc.h"
 
 /* A block device. */
@@ -19,6 +20,8 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long crash_cnt;       /* Writes left before a power
+                                           failure, 0 for none. */
   };
 
 /* List of all block devices. */
@@ -137,6 +140,20 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   ASSERT (block->type != BLOCK_FOREIGN);
   block->ops->write (block->aux, sector, buffer);
   block->write_cnt++;
+  if (block->crash_cnt > 0 && --block->crash_cnt == 0)
+    {
+      printf ("%s: power failure after writing sector %"PRDSNu"\n",
+              block->name, sector);
+      shutdown_crash ();
+    }
+}
+
+/* Makes the power fail right after the next CNT writes to BLOCK,
+   for testing crash recovery. */
+void
+block_crash_after (struct block *block, unsigned long long cnt)
+{
+  block->crash_cnt = cnt;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -200,6 +217,7 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->crash_cnt = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
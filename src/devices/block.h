@@ -53,6 +53,7 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_crash_after (struct block *, unsigned long long cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -5,12 +5,24 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/memtrack.h"
+#include "threads/pressure.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/zswap.h"
+#endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/inode.h"
 #include "filesys/filesys.h"
 #endif
 
@@ -21,6 +33,7 @@
 static enum shutdown_type how = SHUTDOWN_NONE;
 
 static void print_stats (void);
+static void power_off (void) NO_RETURN;
 
 /* Shuts down the machine in the way configured by
    shutdown_configure().  If the shutdown type is SHUTDOWN_NONE
@@ -87,9 +100,6 @@ shutdown_reboot (void)
 void
 shutdown_power_off (void)
 {
-  const char s[] = "Shutdown";
-  const char *p;
-
 #ifdef FILESYS
   filesys_done ();
 #endif
@@ -97,6 +107,26 @@ shutdown_power_off (void)
   print_stats ();
 
   printf ("Powering off...\n");
+  power_off ();
+}
+
+/* Cuts the power at once, as a power failure would: nothing is
+   written back and no statistics are printed.  For testing crash
+   recovery. */
+void
+shutdown_crash (void)
+{
+  printf ("Cutting power...\n");
+  power_off ();
+}
+
+/* Powers down the machine. */
+static void
+power_off (void)
+{
+  const char s[] = "Shutdown";
+  const char *p;
+
   serial_flush ();
 
   /* ACPI power-off */
@@ -134,10 +164,22 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+  dcache_print_stats ();
+  inode_print_stats ();
+  free_map_print_stats ();
+  journal_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
+  kmem_print_stats ();
+  memtrack_print_stats ();
+  pressure_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  frame_print_stats ();
+  zswap_print_stats ();
+#endif
 }
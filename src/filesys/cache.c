@@ -0,0 +1,511 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache.  Keeps the most recently used sectors of the file
+   system device in memory, so that reading a file a few bytes at
+   a time, or rereading it, does not go to the disk every time.
+
+   Writes only go to the cache and mark the sector dirty.  A
+   write-behind thread writes dirty sectors to disk every
+   FLUSH_INTERVAL ticks, and cache_done() writes what is left when
+   the file system shuts down.  When a sector must be brought in
+   and the cache is full, the clock algorithm picks a victim among
+   the entries nobody is using, writing it back first if dirty.
+
+   Callers use a sector's buffer in place between cache_get() and
+   cache_put(), which pins the entry and holds its lock.  A pinned
+   entry is never evicted.  cache_lock protects the lookup table,
+   the clock hand and the pin counts; the data and the dirty bit
+   of an entry are protected by the entry's lock.
+
+   Sequential readers queue the sectors they will want next with
+   cache_prefetch().  A read-ahead thread brings them in, so that
+   by the time a reader gets there the sector is cached.  Requests
+   beyond RA_QUEUE outstanding ones are dropped.
+
+   Sectors written with cache_write_logged() belong to a journal
+   transaction that has not committed.  They are neither evicted
+   nor written back until cache_checkpoint(), since their new
+   contents must reach the journal before their home sectors. */
+
+/* Write-behind period, in timer ticks. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
+/* Outstanding read-ahead requests. */
+#define RA_QUEUE 64
+
+/* A cached sector. */
+struct cache_entry
+  {
+    struct hash_elem hash_elem;         /* In cache_map, if valid. */
+    block_sector_t sector;              /* Sector held. */
+    bool valid;                         /* Holds a sector? */
+    bool accessed;                      /* Used since the clock passed? */
+    int pin_cnt;                        /* Users, cache_lock held. */
+    struct lock lock;                   /* Protects data and dirty. */
+    bool dirty;                         /* Differs from disk? */
+    bool logged;                        /* Held for the journal? */
+    bool prefetched;                    /* Read ahead, not used yet? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+size_t cache_size = 64;
+size_t cache_readahead_max = 32;
+
+static struct cache_entry *entries;
+static struct hash cache_map;           /* Valid entries by sector. */
+static struct lock cache_lock;
+static struct condition unpinned;       /* Signaled when pin_cnt drops
+                                           to 0. */
+static size_t hand;                     /* Clock hand. */
+
+/* Read-ahead queue, a ring protected by ra_lock. */
+static block_sector_t ra_queue[RA_QUEUE];
+static size_t ra_head, ra_cnt;
+static struct lock ra_lock;
+static struct condition ra_ready;
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt, writeback_cnt;
+static long long ra_read_cnt, ra_hit_cnt, ra_drop_cnt;
+
+static void flusher (void *aux);
+static void readahead (void *aux);
+static void flush_entry (struct cache_entry *);
+
+static unsigned
+entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct cache_entry, hash_elem)->sector);
+}
+
+static bool
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct cache_entry, hash_elem)->sector
+          < hash_entry (b, struct cache_entry, hash_elem)->sector);
+}
+
+/* Initializes the buffer cache and starts the write-behind
+   thread. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  if (cache_size == 0)
+    cache_size = 1;
+  entries = calloc (cache_size, sizeof *entries);
+  if (entries == NULL)
+    PANIC ("cannot allocate %zu-sector buffer cache", cache_size);
+  for (i = 0; i < cache_size; i++)
+    lock_init (&entries[i].lock);
+  hash_init (&cache_map, entry_hash, entry_less, NULL);
+  lock_init (&cache_lock);
+  cond_init (&unpinned);
+  lock_init (&ra_lock);
+  cond_init (&ra_ready);
+  if (cache_readahead_max > cache_size / 2)
+    cache_readahead_max = cache_size / 2;
+  thread_create ("flusher", PRI_DEFAULT, flusher, NULL);
+  thread_create ("readahead", PRI_DEFAULT, readahead, NULL);
+}
+
+/* Writes every dirty sector to disk.  Called when the file system
+   shuts down. */
+void
+cache_done (void)
+{
+  cache_flush ();
+}
+
+/* Returns the valid entry holding SECTOR, or a null pointer.
+   cache_lock must be held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  struct cache_entry key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&cache_map, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_entry, hash_elem) : NULL;
+}
+
+/* Picks an entry nobody uses to hold a new sector, with the clock
+   algorithm, waiting if all are in use.  cache_lock must be held.
+   A dirty victim is written back with cache_lock released, so that
+   users of other sectors need not wait for the disk.  It stays
+   pinned and in cache_map meanwhile: a user of its old sector gets
+   a hit and waits on the entry's lock until the write is done.  It
+   is taken only if still unused and clean afterward. */
+static struct cache_entry *
+evict (void)
+{
+  for (;;)
+    {
+      size_t n;
+
+      /* Two sweeps: the first may only clear accessed bits. */
+      for (n = 0; n < 2 * cache_size; n++)
+        {
+          struct cache_entry *e = &entries[hand];
+          hand = (hand + 1) % cache_size;
+          if (e->pin_cnt > 0 || e->logged)
+            continue;
+          if (e->valid && e->accessed)
+            {
+              e->accessed = false;
+              continue;
+            }
+
+          if (e->valid && e->dirty)
+            {
+              e->pin_cnt++;
+              lock_release (&cache_lock);
+              flush_entry (e);
+              lock_acquire (&cache_lock);
+              if (--e->pin_cnt > 0 || e->dirty || e->accessed || e->logged)
+                {
+                  if (e->pin_cnt == 0)
+                    cond_signal (&unpinned, &cache_lock);
+                  continue;
+                }
+            }
+
+          if (e->valid)
+            {
+              hash_delete (&cache_map, &e->hash_elem);
+              e->valid = false;
+              e->prefetched = false;
+            }
+          return e;
+        }
+      cond_wait (&unpinned, &cache_lock);
+    }
+}
+
+/* Returns the cached buffer of SECTOR, which the caller may read
+   and modify in place until it passes the buffer to cache_put().
+   With CACHE_READ the buffer holds the sector's contents; with
+   CACHE_OVERWRITE it holds garbage if the sector was not cached,
+   and the caller must fill all of it.  Do not call again before
+   cache_put(), or the cache may run out of entries. */
+void *
+cache_get (block_sector_t sector, enum cache_mode mode)
+{
+  struct cache_entry *e;
+  bool miss;
+
+  lock_acquire (&cache_lock);
+  e = lookup (sector);
+  miss = e == NULL;
+  if (!miss)
+    {
+      hit_cnt++;
+      if (e->prefetched)
+        {
+          e->prefetched = false;
+          ra_hit_cnt++;
+        }
+    }
+  else
+    {
+      miss_cnt++;
+      e = evict ();
+      e->sector = sector;
+      e->valid = true;
+      hash_insert (&cache_map, &e->hash_elem);
+    }
+  e->pin_cnt++;
+  e->accessed = true;
+
+  /* A new entry was unpinned, so its lock is free and this does
+     not block.  Taking it before dropping cache_lock makes anybody
+     else after the same sector wait until it is filled. */
+  if (miss)
+    lock_acquire (&e->lock);
+  lock_release (&cache_lock);
+  if (!miss)
+    lock_acquire (&e->lock);
+  else if (mode == CACHE_READ)
+    block_read (fs_device, sector, e->data);
+  return e->data;
+}
+
+/* Gives back DATA, a buffer from cache_get().  If DIRTY, the
+   caller modified it and it will be written to disk later. */
+void
+cache_put (void *data, bool dirty)
+{
+  struct cache_entry *e;
+
+  e = (struct cache_entry *) ((uint8_t *) data
+                              - offsetof (struct cache_entry, data));
+  ASSERT (e >= entries && e < entries + cache_size);
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (dirty)
+    e->dirty = true;
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_signal (&unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Reads SECTOR into BUFFER, BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BUFFER, BLOCK_SECTOR_SIZE bytes, to SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes at offset OFS of SECTOR into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  uint8_t *data;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+  data = cache_get (sector, CACHE_READ);
+  memcpy (buffer, data + ofs, size);
+  cache_put (data, false);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of SECTOR.  The
+   sector is not read from disk if all of it is written. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size)
+{
+  uint8_t *data;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+  data = cache_get (sector, size == BLOCK_SECTOR_SIZE
+                            ? CACHE_OVERWRITE : CACHE_READ);
+  memcpy (data + ofs, buffer, size);
+  cache_put (data, true);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of SECTOR, and
+   holds the sector in the cache until cache_checkpoint(). */
+void
+cache_write_logged (block_sector_t sector, const void *buffer,
+                    size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+  uint8_t *data;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+  data = cache_get (sector, size == BLOCK_SECTOR_SIZE
+                            ? CACHE_OVERWRITE : CACHE_READ);
+  memcpy (data + ofs, buffer, size);
+  e = (struct cache_entry *) (data - offsetof (struct cache_entry, data));
+  e->logged = true;
+  cache_put (data, true);
+}
+
+/* Writes SECTOR, which cache_write_logged() wrote, to disk and
+   lets it be evicted again. */
+void
+cache_checkpoint (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = lookup (sector);
+  ASSERT (e != NULL && e->logged);
+  e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  e->logged = false;
+  lock_release (&e->lock);
+  flush_entry (e);
+
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_signal (&unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes SECTOR to disk now if it is cached and dirty, unless it
+   is held for the journal. */
+void
+cache_flush_sector (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = lookup (sector);
+  if (e != NULL)
+    e->pin_cnt++;
+  lock_release (&cache_lock);
+  if (e == NULL)
+    return;
+
+  flush_entry (e);
+
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_signal (&unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes E to disk if it is dirty and not held for the journal.
+   E must be pinned. */
+static void
+flush_entry (struct cache_entry *e)
+{
+  lock_acquire (&e->lock);
+  if (e->dirty && !e->logged)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      writeback_cnt++;
+    }
+  lock_release (&e->lock);
+}
+
+/* Writes every dirty sector to disk, except those held for the
+   journal. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < cache_size; i++)
+    {
+      struct cache_entry *e = &entries[i];
+      bool flush;
+
+      lock_acquire (&cache_lock);
+      flush = e->valid && e->dirty;
+      if (flush)
+        e->pin_cnt++;
+      lock_release (&cache_lock);
+      if (!flush)
+        continue;
+
+      flush_entry (e);
+
+      lock_acquire (&cache_lock);
+      if (--e->pin_cnt == 0)
+        cond_signal (&unpinned, &cache_lock);
+      lock_release (&cache_lock);
+    }
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache.  Does
+   not wait. */
+void
+cache_prefetch (block_sector_t sector)
+{
+  lock_acquire (&ra_lock);
+  if (ra_cnt < RA_QUEUE)
+    {
+      ra_queue[(ra_head + ra_cnt++) % RA_QUEUE] = sector;
+      cond_signal (&ra_ready, &ra_lock);
+    }
+  else
+    ra_drop_cnt++;
+  lock_release (&ra_lock);
+}
+
+/* Brings SECTOR into the cache, unless it is there already. */
+static void
+prefetch_sector (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  if (lookup (sector) != NULL)
+    {
+      lock_release (&cache_lock);
+      return;
+    }
+  e = evict ();
+  e->sector = sector;
+  e->valid = true;
+  e->accessed = true;
+  e->prefetched = true;
+  hash_insert (&cache_map, &e->hash_elem);
+  e->pin_cnt++;
+  lock_acquire (&e->lock);
+  lock_release (&cache_lock);
+
+  block_read (fs_device, sector, e->data);
+  ra_read_cnt++;
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_signal (&unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Read-ahead thread. */
+static void
+readahead (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_ready, &ra_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % RA_QUEUE;
+      ra_cnt--;
+      lock_release (&ra_lock);
+
+      prefetch_sector (sector);
+    }
+}
+
+/* Write-behind thread. */
+static void
+flusher (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  long long total = hit_cnt + miss_cnt;
+
+  if (entries == NULL)
+    return;
+  printf ("Buffer cache: %zu sectors, %lld hits, %lld misses "
+          "(%lld%% hit ratio), %lld sectors written back\n",
+          cache_size, hit_cnt, miss_cnt,
+          total > 0 ? hit_cnt * 100 / total : 0, writeback_cnt);
+  printf ("Read-ahead: %lld sectors read, %lld of them used, "
+          "%lld requests dropped\n", ra_read_cnt, ra_hit_cnt, ra_drop_cnt);
+}
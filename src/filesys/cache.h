@@ -0,0 +1,40 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Number of sectors cached, kernel option -cache. */
+extern size_t cache_size;
+
+/* Largest read-ahead window in sectors, kernel option -ra. */
+extern size_t cache_readahead_max;
+
+/* How cache_get() fills a sector's buffer. */
+enum cache_mode
+  {
+    CACHE_READ,                 /* With the sector's contents. */
+    CACHE_OVERWRITE             /* Not at all, caller writes it all. */
+  };
+
+void cache_init (void);
+void cache_done (void);
+
+void *cache_get (block_sector_t, enum cache_mode);
+void cache_put (void *data, bool dirty);
+
+void cache_read (block_sector_t, void *buffer);
+void cache_write (block_sector_t, const void *buffer);
+void cache_read_at (block_sector_t, void *buffer, size_t ofs, size_t size);
+void cache_write_at (block_sector_t, const void *buffer,
+                     size_t ofs, size_t size);
+void cache_write_logged (block_sector_t, const void *buffer,
+                         size_t ofs, size_t size);
+void cache_checkpoint (block_sector_t);
+void cache_prefetch (block_sector_t);
+void cache_flush (void);
+void cache_flush_sector (block_sector_t);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
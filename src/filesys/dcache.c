@@ -0,0 +1,228 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+
+/* Dentry cache.  Remembers what looking up a name in a directory
+   gave, keyed by the directory's inode sector and the name, so
+   that resolving a path that was resolved recently reads no
+   directory at all: it goes straight from one inode to the
+   next.  Names found missing are cached too, as negative
+   entries, since build tools look for many files that are not
+   there.
+
+   The cache holds at most dcache_size entries and drops the least
+   recently used one to make room.  dir_add() and dir_remove()
+   invalidate the entry for the name they change, and removing a
+   directory drops every entry under it, so an entry is never
+   stale.  Sector numbers stay valid for as long as the entry that
+   names them, because a sector is only freed after its name has
+   been removed, so dcache_open() opens the inode before it lets go
+   of the entry: once it is open, its sector cannot be freed and
+   reused. */
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* In dentries. */
+    struct list_elem lru_elem;          /* In lru, most recent first. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name within it. */
+    enum dentry_state state;            /* What the name is. */
+    block_sector_t sector;              /* Its inode sector, if any. */
+  };
+
+size_t dcache_size = 128;
+
+static struct hash dentries;            /* Entries by (dir, name). */
+static struct list lru;                 /* Entries, most recent first. */
+static struct kmem_cache *dentry_cache;
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+/* Statistics. */
+static long long hit_cnt, negative_cnt, miss_cnt, evict_cnt;
+
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru);
+  lock_init (&dcache_lock);
+  dentry_cache = kmem_cache_create ("dentry", sizeof (struct dentry), NULL);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer.
+   dcache_lock must be held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Drops entry D.  dcache_lock must be held. */
+static void
+drop (struct dentry *d)
+{
+  hash_delete (&dentries, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  kmem_cache_free (dentry_cache, d);
+}
+
+/* Returns what is cached about NAME in the directory whose inode
+   is in sector DIR.  If it is DENTRY_FILE or DENTRY_DIR, opens the
+   inode of NAME and stores it into *INODEP, or a null pointer if
+   memory is short; otherwise stores a null pointer. */
+enum dentry_state
+dcache_open (block_sector_t dir, const char *name, struct inode **inodep)
+{
+  enum dentry_state state = DENTRY_UNKNOWN;
+  struct dentry *d;
+
+  *inodep = NULL;
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru, &d->lru_elem);
+      state = d->state;
+      if (state == DENTRY_ABSENT)
+        negative_cnt++;
+      else
+        {
+          *inodep = inode_open (d->sector);
+          hit_cnt++;
+        }
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+  return state;
+}
+
+/* Records that NAME in the directory whose inode is in sector DIR
+   is in STATE, with its inode in SECTOR unless STATE is
+   DENTRY_ABSENT.  The caller must have just looked NAME up in the
+   directory itself and still hold the directory's lock, so that no
+   dir_add() or dir_remove() can invalidate the name in between. */
+void
+dcache_insert (block_sector_t dir, const char *name,
+               enum dentry_state state, block_sector_t sector)
+{
+  struct dentry *d;
+
+  ASSERT (state != DENTRY_UNKNOWN);
+  if (dcache_size == 0 || strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else
+    {
+      /* Make room, or reuse the least recently used entry if
+         memory is short. */
+      if (hash_size (&dentries) >= dcache_size
+          || (d = kmem_cache_alloc (dentry_cache)) == NULL)
+        {
+          if (list_empty (&lru))
+            goto done;
+          d = list_entry (list_back (&lru), struct dentry, lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+          list_remove (&d->lru_elem);
+          evict_cnt++;
+        }
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->state = state;
+  d->sector = sector;
+  list_push_front (&lru, &d->lru_elem);
+
+ done:
+  lock_release (&dcache_lock);
+}
+
+/* Forgets what is cached about NAME in the directory whose inode
+   is in sector DIR.  Called whenever that name is added or
+   removed. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    drop (d);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name cached in the directory whose inode is in
+   sector DIR.  Called when that directory is removed, since its
+   sector will be reused. */
+void
+dcache_purge_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru); e != list_end (&lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        drop (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints dentry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  long long total = hit_cnt + negative_cnt + miss_cnt;
+
+  if (dentry_cache == NULL)
+    return;
+  printf ("Dentry cache: %zu names, %lld hits, %lld negative hits, "
+          "%lld misses (%lld%% hit ratio), %lld evicted\n",
+          dcache_size, hit_cnt, negative_cnt, miss_cnt,
+          total > 0 ? (hit_cnt + negative_cnt) * 100 / total : 0,
+          evict_cnt);
+}
@@ -0,0 +1,29 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Number of names cached, kernel option -dcache. */
+extern size_t dcache_size;
+
+/* What the dentry cache knows about a name in a directory. */
+enum dentry_state
+  {
+    DENTRY_UNKNOWN,             /* Not cached. */
+    DENTRY_ABSENT,              /* No such name. */
+    DENTRY_FILE,                /* An ordinary file. */
+    DENTRY_DIR                  /* A directory. */
+  };
+
+void dcache_init (void);
+struct inode;
+enum dentry_state dcache_open (block_sector_t dir, const char *name,
+                               struct inode **inodep);
+void dcache_insert (block_sector_t dir, const char *name,
+                    enum dentry_state, block_sector_t sector);
+void dcache_invalidate (block_sector_t dir, const char *name);
+void dcache_purge_dir (block_sector_t dir);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
@@ -1,41 +1,227 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
-struct dir 
+struct dir
   {
     struct inode *inode;                /* Backing store. */
+    struct dir_index *index;            /* Entries by name. */
     off_t pos;                          /* Current position. */
   };
 
 /* A single directory entry. */
-struct dir_entry 
+struct dir_entry
   {
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
   };
 
+/* In-memory index of a directory, shared by every `struct dir'
+   for it.  It is built from the directory's entries when the
+   directory is first opened and kept in step by dir_add() and
+   dir_remove(), so that looking up a name, adding an entry or
+   removing one takes no scan of the directory however large it
+   grows.
+
+   Path lookups open and close each directory on the way, so an
+   index outlives its last close: the root directory's for good,
+   others on an LRU list of up to INDEX_KEEP.  Every change to a
+   directory goes through an open `struct dir', so a kept index
+   stays in step with the disk.  A removed directory's index is
+   freed at its last close, before its sector can be reused.
+
+   LOCK serializes the operations on one directory, so that
+   checking whether a name exists and adding or removing it is
+   atomic; operations on different directories run in parallel.
+   When removing a directory, its parent's lock is taken first. */
+struct dir_index
+  {
+    struct hash_elem elem;              /* In open_indexes. */
+    block_sector_t sector;              /* Directory's inode sector. */
+    int open_cnt;                       /* Number of `struct dir's. */
+    bool removed;                       /* Directory removed? */
+    struct list_elem lru_elem;          /* In unused_indexes, if kept. */
+    struct lock lock;                   /* Serializes operations. */
+    struct hash names;                  /* Entries in use, by name. */
+    struct list free_slots;             /* Entries not in use. */
+    off_t end;                          /* Offset just past the entries. */
+  };
+
+/* An entry of a directory index. */
+struct dir_name
+  {
+    struct hash_elem hash_elem;         /* In names, if in use. */
+    struct list_elem list_elem;         /* In free_slots, if not. */
+    off_t ofs;                          /* Byte offset of the entry. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* Indexes of unopened directories kept, besides the root's. */
+#define INDEX_KEEP 16
+
+/* Indexes of open and kept directories, by inode sector, the kept
+   ones other than the root's, most recently closed first, and the
+   lock that protects these and the indexes' open counts and
+   removed flags. */
+static struct hash open_indexes;
+static struct list unused_indexes;
+static size_t unused_cnt;
+static struct lock open_indexes_lock;
+
+static hash_hash_func index_hash, name_hash;
+static hash_less_func index_less, name_less;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  hash_init (&open_indexes, index_hash, index_less, NULL);
+  list_init (&unused_indexes);
+  lock_init (&open_indexes_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, whose parent directory is in sector
+   PARENT_SECTOR.  The root directory is its own parent.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt,
+            block_sector_t parent_sector)
+{
+  struct dir *dir;
+  bool success;
+
+  if (!inode_create (sector, entry_cnt * sizeof (struct dir_entry), true))
+    return false;
+  dir = dir_open (inode_open (sector));
+  success = (dir != NULL
+             && dir_add (dir, ".", sector)
+             && dir_add (dir, "..", parent_sector));
+  dir_close (dir);
+  return success;
+}
+
+/* Frees index entry E. */
+static void
+free_name (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct dir_name, hash_elem));
+}
+
+/* Frees INDEX and all its entries. */
+static void
+free_index (struct dir_index *index)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  while (!list_empty (&index->free_slots))
+    {
+      struct list_elem *e = list_pop_front (&index->free_slots);
+      free (list_entry (e, struct dir_name, list_elem));
+    }
+  hash_destroy (&index->names, free_name);
+  free (index);
+}
+
+/* Reads the entries of the directory in INODE into a new index.
+   Returns the index, or a null pointer if memory allocation
+   fails. */
+static struct dir_index *
+build_index (struct inode *inode)
+{
+  struct dir_index *index = malloc (sizeof *index);
+  struct dir_entry e;
+
+  if (index == NULL)
+    return NULL;
+  if (!hash_init (&index->names, name_hash, name_less, NULL))
+    {
+      free (index);
+      return NULL;
+    }
+  index->sector = inode_get_inumber (inode);
+  index->open_cnt = 0;
+  index->removed = false;
+  lock_init (&index->lock);
+  list_init (&index->free_slots);
+
+  for (index->end = 0;
+       inode_read_at (inode, &e, sizeof e, index->end) == sizeof e;
+       index->end += sizeof e)
+    {
+      struct dir_name *n = malloc (sizeof *n);
+      if (n == NULL)
+        {
+          free_index (index);
+          return NULL;
+        }
+      n->ofs = index->end;
+      n->inode_sector = e.inode_sector;
+      if (e.in_use)
+        {
+          strlcpy (n->name, e.name, sizeof n->name);
+          hash_insert (&index->names, &n->hash_elem);
+        }
+      else
+        list_push_back (&index->free_slots, &n->list_elem);
+    }
+  return index;
+}
+
+/* Returns the index of the directory in INODE, building it if
+   it is neither open nor kept.  Returns a null pointer if memory
+   allocation fails.
+   The index is built with open_indexes_lock held, so that nobody
+   can change the directory meanwhile.  That makes first opens of
+   directories wait for each other, but later opens find the index
+   and lookups through the dentry cache need none. */
+static struct dir_index *
+get_index (struct inode *inode)
+{
+  struct dir_index key, *index;
+  struct hash_elem *e;
+
+  lock_acquire (&open_indexes_lock);
+  key.sector = inode_get_inumber (inode);
+  e = hash_find (&open_indexes, &key.elem);
+  if (e != NULL)
+    {
+      index = hash_entry (e, struct dir_index, elem);
+      if (index->open_cnt == 0 && index->sector != ROOT_DIR_SECTOR)
+        {
+          list_remove (&index->lru_elem);
+          unused_cnt--;
+        }
+    }
+  else
+    {
+      index = build_index (inode);
+      if (index != NULL)
+        hash_insert (&open_indexes, &index->elem);
+    }
+  if (index != NULL)
+    index->open_cnt++;
+  lock_release (&open_indexes_lock);
+  return index;
 }
 
 /* Opens and returns the directory for the given INODE, of which
-   it takes ownership.  Returns a null pointer on failure. */
+   it takes ownership.  Returns a null pointer on failure, which
+   includes INODE not being a directory. */
 struct dir *
-dir_open (struct inode *inode) 
+dir_open (struct inode *inode)
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL && inode_is_dir (inode)
+      && (dir->index = get_index (inode)) != NULL)
     {
       dir->inode = inode;
       dir->pos = 0;
@@ -45,7 +231,7 @@ dir_open (struct inode *inode)
     {
       inode_close (inode);
       free (dir);
-      return NULL; 
+      return NULL;
     }
 }
 
@@ -60,17 +246,41 @@ dir_open_root (void)
 /* Opens and returns a new directory for the same inode as DIR.
    Returns a null pointer on failure. */
 struct dir *
-dir_reopen (struct dir *dir) 
+dir_reopen (struct dir *dir)
 {
   return dir_open (inode_reopen (dir->inode));
 }
 
 /* Destroys DIR and frees associated resources. */
 void
-dir_close (struct dir *dir) 
+dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
+      struct dir_index *index = dir->index;
+      struct dir_index *victim = NULL;
+
+      lock_acquire (&open_indexes_lock);
+      if (--index->open_cnt == 0 && index->sector != ROOT_DIR_SECTOR)
+        {
+          if (index->removed)
+            victim = index;
+          else
+            {
+              list_push_front (&unused_indexes, &index->lru_elem);
+              if (++unused_cnt > INDEX_KEEP)
+                {
+                  victim = list_entry (list_pop_back (&unused_indexes),
+                                       struct dir_index, lru_elem);
+                  unused_cnt--;
+                }
+            }
+        }
+      if (victim != NULL)
+        hash_delete (&open_indexes, &victim->elem);
+      lock_release (&open_indexes_lock);
+      if (victim != NULL)
+        free_index (victim);
       inode_close (dir->inode);
       free (dir);
     }
@@ -78,57 +288,65 @@ dir_close (struct dir *dir)
 
 /* Returns the inode encapsulated by DIR. */
 struct inode *
-dir_get_inode (struct dir *dir) 
+dir_get_inode (struct dir *dir)
 {
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
-static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+/* Searches DIR for a file with the given NAME and returns its
+   index entry, or a null pointer if there is none.  DIR's lock
+   must be held. */
+static struct dir_name *
+lookup (const struct dir *dir, const char *name)
 {
-  struct dir_entry e;
-  size_t ofs;
-  
+  struct dir_name key;
+  struct hash_elem *e;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      } 
-  return false;
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dir->index->names, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dir_name, hash_elem) : NULL;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   A directory that has been removed contains nothing, not even
+   "." and "..".
+   The answer goes into the dentry cache, while DIR's lock keeps
+   dir_add() and dir_remove() from invalidating it first. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
-            struct inode **inode) 
+            struct inode **inode)
 {
-  struct dir_entry e;
+  struct dir_name *n;
+  bool removed;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  lock_acquire (&dir->index->lock);
+  removed = inode_is_removed (dir->inode);
+  n = removed ? NULL : lookup (dir, name);
+  if (n != NULL)
+    *inode = inode_open (n->inode_sector);
   else
     *inode = NULL;
 
+  /* Nothing is cached under a removed directory, whose sector
+     will be reused. */
+  if (!removed && (n == NULL || *inode != NULL))
+    dcache_insert (dir->index->sector, name,
+                   n == NULL ? DENTRY_ABSENT
+                   : inode_is_dir (*inode) ? DENTRY_DIR : DENTRY_FILE,
+                   n != NULL ? n->inode_sector : 0);
+  lock_release (&dir->index->lock);
+
   return *inode != NULL;
 }
 
@@ -136,101 +354,216 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), if DIR has been
+   removed or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_index *index;
   struct dir_entry e;
-  off_t ofs;
+  struct dir_name *n;
+
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
+  index = dir->index;
 
   /* Check NAME for validity. */
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  lock_acquire (&index->lock);
+
+  /* Check that NAME is not in use, and that DIR is not removed. */
+  if (inode_is_removed (dir->inode) || lookup (dir, name) != NULL)
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Take a free slot, or one at the current end-of-file if there
+     are none. */
+  if (!list_empty (&index->free_slots))
+    n = list_entry (list_front (&index->free_slots), struct dir_name,
+                    list_elem);
+  else
+    {
+      n = malloc (sizeof *n);
+      if (n == NULL)
+        goto done;
+      n->ofs = index->end;
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (inode_write_at (dir->inode, &e, sizeof e, n->ofs) != sizeof e)
+    {
+      if (n->ofs == index->end)
+        free (n);
+      goto done;
+    }
+
+  /* Index it. */
+  if (n->ofs == index->end)
+    index->end += sizeof e;
+  else
+    list_remove (&n->list_elem);
+  n->inode_sector = inode_sector;
+  strlcpy (n->name, name, sizeof n->name);
+  hash_insert (&index->names, &n->hash_elem);
+  dcache_invalidate (index->sector, name);
+  success = true;
 
  done:
+  lock_release (&index->lock);
   return success;
 }
 
+/* Returns true if DIR holds no entries but "." and "..".  DIR's
+   lock must be held. */
+static bool
+dir_is_empty (const struct dir *dir)
+{
+  return hash_size (&dir->index->names) <= 2;
+}
+
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs only if there is no file with the given NAME, if
+   NAME is "." or "..", or if NAME is a directory that is not
+   empty. */
 bool
-dir_remove (struct dir *dir, const char *name) 
+dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
+  struct dir_name *n;
   struct inode *inode = NULL;
+  struct dir *child = NULL;
   bool success = false;
-  off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&dir->index->lock);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  n = lookup (dir, name);
+  if (n == NULL || !strcmp (name, ".") || !strcmp (name, ".."))
     goto done;
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (n->inode_sector);
   if (inode == NULL)
     goto done;
 
+  /* A directory must be empty.  Its lock is held until it is
+     marked removed, so that nothing can be added to it meanwhile. */
+  if (inode_is_dir (inode))
+    {
+      child = dir_open (inode_reopen (inode));
+      if (child == NULL)
+        goto done;
+      lock_acquire (&child->index->lock);
+      if (!dir_is_empty (child))
+        goto done;
+    }
+
   /* Erase directory entry. */
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  e.inode_sector = 0;
+  memset (e.name, 0, sizeof e.name);
+  if (inode_write_at (dir->inode, &e, sizeof e, n->ofs) != sizeof e)
     goto done;
+  hash_delete (&dir->index->names, &n->hash_elem);
+  list_push_front (&dir->index->free_slots, &n->list_elem);
+  dcache_invalidate (dir->index->sector, name);
+  if (child != NULL)
+    dcache_purge_dir (inode_get_inumber (inode));
 
-  /* Remove inode. */
+  /* Remove inode.  The child's index goes at its last close. */
   inode_remove (inode);
+  if (child != NULL)
+    {
+      lock_acquire (&open_indexes_lock);
+      child->index->removed = true;
+      lock_release (&open_indexes_lock);
+    }
   success = true;
 
  done:
+  if (child != NULL)
+    {
+      lock_release (&child->index->lock);
+      dir_close (child);
+    }
+  lock_release (&dir->index->lock);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  "." and ".." are skipped. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
     {
       dir->pos += sizeof e;
-      if (e.in_use)
+      if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
           return true;
-        } 
+        }
     }
   return false;
 }
+
+/* Sets the position dir_readdir() reads DIR from to POS, a value
+   returned by dir_tell(). */
+void
+dir_seek (struct dir *dir, off_t pos)
+{
+  dir->pos = pos;
+}
+
+/* Returns the position dir_readdir() reads DIR from next. */
+off_t
+dir_tell (const struct dir *dir)
+{
+  return dir->pos;
+}
+
+/* Returns a hash value for directory index E. */
+static unsigned
+index_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct dir_index, elem)->sector);
+}
+
+/* Returns true if directory index A precedes B. */
+static bool
+index_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct dir_index, elem)->sector
+          < hash_entry (b, struct dir_index, elem)->sector);
+}
+
+/* Returns a hash value for index entry E. */
+static unsigned
+name_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_entry (e, struct dir_name, hash_elem)->name);
+}
+
+/* Returns true if index entry A precedes B. */
+static bool
+name_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct dir_name, hash_elem)->name,
+                 hash_entry (b, struct dir_name, hash_elem)->name) < 0;
+}
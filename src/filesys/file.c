@@ -1,7 +1,9 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "filesys/cache.h"
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* An open file. */
 struct file 
@@ -9,26 +11,62 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    struct lock lock;           /* Protects pos and the read-ahead state. */
+
+    /* Read-ahead.  A read starting where the last one ended is
+       sequential and doubles the window, anything else closes
+       it. */
+    off_t ra_next;              /* Where a sequential read starts. */
+    off_t ra_end;               /* End of what was read ahead. */
+    size_t ra_window;           /* Read-ahead window in sectors. */
   };
 
+/* Smallest read-ahead window, in sectors. */
+#define RA_MIN 4
+
+/* Open files come from here. */
+static struct kmem_cache *file_cache;
+
+/* Constructor for file_cache: a closed file at offset 0. */
+static void
+file_ctor (void *obj)
+{
+  struct file *file = obj;
+  file->inode = NULL;
+  file->pos = 0;
+  file->deny_write = false;
+  file->ra_next = file->ra_end = 0;
+  file->ra_window = 0;
+  lock_init (&file->lock);
+}
+
+/* Initializes the open file module. */
+void
+file_init (void)
+{
+  file_cache = kmem_cache_create ("file", sizeof (struct file), file_ctor);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (file_cache, file);
       return NULL; 
     }
 }
@@ -49,7 +87,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      kmem_cache_free (file_cache, file);
     }
 }
 
@@ -68,8 +106,40 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read;
+
+  lock_acquire (&file->lock);
+  if (file->pos != file->ra_next)
+    {
+      /* Not sequential, start over. */
+      file->ra_window = 0;
+      file->ra_end = file->pos;
+    }
+  else if (file->ra_window < cache_readahead_max)
+    {
+      file->ra_window = file->ra_window == 0 ? RA_MIN : file->ra_window * 2;
+      if (file->ra_window > cache_readahead_max)
+        file->ra_window = cache_readahead_max;
+    }
+
+  bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->ra_next = file->pos;
+
+  /* Keep the window ahead of the reader in flight. */
+  if (file->ra_window > 0)
+    {
+      off_t target = file->pos + (off_t) file->ra_window * BLOCK_SECTOR_SIZE;
+      if (file->ra_end < file->pos)
+        file->ra_end = file->pos;
+      if (file->ra_end < target)
+        {
+          inode_readahead (file->inode, file->ra_end,
+                           target - file->ra_end);
+          file->ra_end = target;
+        }
+    }
+  lock_release (&file->lock);
   return bytes_read;
 }
 
@@ -87,24 +157,28 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
-   Advances FILE's position by the number of bytes read. */
+   which may be less than SIZE if the disk fills up or the
+   largest file size is reached.
+   Writing past end of file extends the file.
+   Advances FILE's position by the number of bytes written. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  off_t bytes_written;
+
+  lock_acquire (&file->lock);
+  bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_written;
+  lock_release (&file->lock);
   return bytes_written;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up or the
+   largest file size is reached.
+   Writing past end of file extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -155,7 +229,11 @@ file_seek (struct file *file, off_t new_pos)
 {
   ASSERT (file != NULL);
   ASSERT (new_pos >= 0);
+  lock_acquire (&file->lock);
   file->pos = new_pos;
+  file->ra_window = 0;
+  file->ra_end = new_pos;
+  lock_release (&file->lock);
 }
 
 /* Returns the current position in FILE as a byte offset from the
@@ -163,6 +241,11 @@ file_seek (struct file *file, off_t new_pos)
 off_t
 file_tell (struct file *file) 
 {
+  off_t pos;
+
   ASSERT (file != NULL);
-  return file->pos;
+  lock_acquire (&file->lock);
+  pos = file->pos;
+  lock_release (&file->lock);
+  return pos;
 }
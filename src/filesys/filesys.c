@@ -2,21 +2,25 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/shutdown.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 
-#include "threads/synch.h"
-
-static struct lock fs_mutex;
-
-void fs_take(void) { lock_acquire(&fs_mutex); }
-void fs_give(void) { lock_release(&fs_mutex); }
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Writes to the file system device after which the power is cut,
+   0 for never, kernel option -crash.  If the run ends first, the
+   power is cut at shutdown instead. */
+unsigned long filesys_crash_after;
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -28,7 +32,17 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  /* Count writes from the mount on, so that a crash can hit the
+     journal replay too, but never the format. */
+  if (filesys_crash_after > 0 && !format)
+    block_crash_after (fs_device, filesys_crash_after);
+
+  cache_init ();
+  journal_init (format);
   inode_init ();
+  dir_init ();
+  dcache_init ();
+  file_init ();
   free_map_init ();
 
   if (format) 
@@ -36,7 +50,8 @@ filesys_init (bool format)
 
   free_map_open ();
 
-  lock_init(&fs_mutex);
+  if (filesys_crash_after > 0 && format)
+    block_crash_after (fs_device, filesys_crash_after);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -44,9 +59,146 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  journal_done ();
+  if (filesys_crash_after > 0)
+    {
+      /* The crash point was not reached.  Cut the power anyway,
+         after the last commit but before write-back, so that what
+         the run did must survive on the strength of the journal
+         alone. */
+      printf ("Power failure at shutdown, after the last commit\n");
+      shutdown_crash ();
+    }
   free_map_close ();
+  cache_done ();
 }
 
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX character from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Opens the directory that relative paths start from: the running
+   process's working directory, or the root directory. */
+static struct inode *
+cwd_inode (void)
+{
+#ifdef USERPROG
+  struct thread *t = thread_current ();
+  if (t->cwd != NULL)
+    return inode_reopen (dir_get_inode (t->cwd));
+#endif
+  return inode_open (ROOT_DIR_SECTOR);
+}
+
+/* Looks up NAME in directory DIR_INODE, going to the directory
+   only if the dentry cache does not know the answer, in which case
+   dir_lookup() caches it.  Returns the inode of NAME, opened, or a
+   null pointer if NAME does not exist or memory is short. */
+static struct inode *
+lookup (struct inode *dir_inode, const char *name)
+{
+  struct inode *inode;
+
+  if (dcache_open (inode_get_inumber (dir_inode), name, &inode)
+      == DENTRY_UNKNOWN)
+    {
+      struct dir *dir = dir_open (inode_reopen (dir_inode));
+      if (dir != NULL)
+        dir_lookup (dir, name, &inode);
+      dir_close (dir);
+    }
+  return inode;
+}
+
+/* Finds the directory that holds the last component of PATH,
+   returns its inode, opened, and stores the component into NAME.
+   A path that names a directory by itself, such as "/", leaves
+   "." in NAME.
+   Returns a null pointer if PATH is empty, if a component before
+   the last is missing or not a directory, or if a component is
+   too long.  Each directory on the way is kept open until the
+   next one is, so that none can be removed and its sector reused
+   while it is being looked in. */
+static struct inode *
+resolve (const char *path, char name[NAME_MAX + 1])
+{
+  char part[NAME_MAX + 1];
+  struct inode *dir;
+  int r = 0;
+
+  if (*path == '\0')
+    return NULL;
+  dir = *path == '/' ? inode_open (ROOT_DIR_SECTOR) : cwd_inode ();
+  strlcpy (name, ".", NAME_MAX + 1);
+
+  while (dir != NULL && (r = get_next_part (part, &path)) != 0)
+    {
+      const char *rest = path;
+      struct inode *next;
+
+      if (r < 0)
+        break;
+
+      /* The last component is left to the caller. */
+      while (*rest == '/')
+        rest++;
+      if (*rest == '\0')
+        {
+          strlcpy (name, part, NAME_MAX + 1);
+          return dir;
+        }
+
+      next = lookup (dir, part);
+      inode_close (dir);
+      dir = next;
+      if (dir != NULL && !inode_is_dir (dir))
+        break;
+    }
+  if (dir != NULL && r == 0)
+    return dir;
+  inode_close (dir);
+  return NULL;
+}
+
+/* Opens the directory that holds the last component of PATH and
+   stores that component into NAME, as resolve() does.  Returns a
+   null pointer on failure.  The caller must close the
+   directory. */
+static struct dir *
+resolve_dir (const char *path, char name[NAME_MAX + 1])
+{
+  return dir_open (resolve (path, name));
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -55,13 +207,53 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  char leaf[NAME_MAX + 1];
+  struct dir *dir = resolve_dir (name, leaf);
+  bool success;
+
+  journal_begin ();
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && inode_create (inode_sector, initial_size, false)
+             && dir_add (dir, leaf, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
+  journal_end ();
+  dir_close (dir);
+
+  return success;
+}
+
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists, if a directory
+   on the way to it does not, or if internal memory or disk
+   allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  block_sector_t inode_sector = 0;
+  char leaf[NAME_MAX + 1];
+  struct dir *dir = resolve_dir (name, leaf);
+  bool success;
+
+  journal_begin ();
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && dir_create (inode_sector, 16,
+                            inode_get_inumber (dir_get_inode (dir))));
+  if (!success && inode_sector != 0)
+    free_map_release (inode_sector, 1);
+  else if (success && !dir_add (dir, leaf, inode_sector))
+    {
+      /* Free the directory's sectors along with its inode. */
+      struct inode *inode = inode_open (inode_sector);
+      if (inode != NULL)
+        inode_remove (inode);
+      inode_close (inode);
+      success = false;
+    }
+  journal_end ();
   dir_close (dir);
 
   return success;
@@ -71,42 +263,87 @@ filesys_create (const char *name, off_t initial_size)
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   or if an internal memory allocation fails.
+   NAME may be a directory, which can then be read with
+   dir_readdir(). */
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
-  struct inode *inode = NULL;
-
-  if (dir != NULL)
-    dir_lookup (dir, name, &inode);
-  dir_close (dir);
+  char leaf[NAME_MAX + 1];
+  struct inode *dir = resolve (name, leaf);
+  struct inode *inode;
 
+  if (dir == NULL)
+    return NULL;
+  inode = lookup (dir, leaf);
+  inode_close (dir);
   return file_open (inode);
 }
 
 /* Deletes the file named NAME.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
+   Fails if no file named NAME exists, if NAME is a directory
+   that is not empty or is the root directory,
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char leaf[NAME_MAX + 1];
+  struct dir *dir = resolve_dir (name, leaf);
+  bool success;
+
+  journal_begin ();
+  success = dir != NULL && dir_remove (dir, leaf);
+  journal_end ();
   dir_close (dir); 
 
   return success;
 }
-
+
+#ifdef USERPROG
+/* Makes the directory named NAME the working directory of the
+   running process.
+   Returns true if successful, false if NAME does not exist or is
+   not a directory. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *t = thread_current ();
+  char leaf[NAME_MAX + 1];
+  struct inode *dir = resolve (name, leaf);
+  struct inode *inode;
+  struct dir *cwd;
+
+  if (dir == NULL)
+    return false;
+  inode = lookup (dir, leaf);
+  inode_close (dir);
+  if (inode == NULL || !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+  cwd = dir_open (inode);
+  if (cwd == NULL)
+    return false;
+  dir_close (t->cwd);
+  t->cwd = cwd;
+  return true;
+}
+#endif
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  journal_begin ();
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
+  journal_end ();
   free_map_close ();
+  journal_commit ();
+  cache_flush ();
   printf ("done.\n");
 }
@@ -11,13 +11,15 @@
 /* Block device that contains the file system. */
 struct block *fs_device;
 
+/* Writes after which the power is cut, kernel option -crash. */
+extern unsigned long filesys_crash_after;
+
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
+bool filesys_mkdir (const char *name);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
-
-void fs_take(void);
-void fs_give(void);
+bool filesys_chdir (const char *name);
 
 #endif /* filesys/filesys.h */
@@ -1,68 +1,464 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Protects the free map and its file.  Taken with a file's inode
+   locked for writing, when writing the file allocates a sector,
+   and taken before the free map file's own inode. */
+static struct lock free_map_lock;
+
+/* Free extents.
+
+   The bitmap above is what goes to disk, but allocation does not
+   scan it.  Instead every maximal run of free sectors is kept as
+   a free extent, indexed three ways: by its first sector, so that
+   a file can be extended in place; by the sector just past its
+   end, so that released sectors merge with the run before them;
+   and in one of BUCKET_CNT buckets by the log2 of its length, so
+   that a run of a given size is found without a scan.
+
+   Allocation takes sectors from the start of an extent only, so
+   it never needs a new one.  Release needs one only when the
+   sectors touch no free extent; if that fails for lack of memory
+   the sectors are left out, and the extents are rebuilt from the
+   bitmap the next time they cannot satisfy an allocation. */
+struct free_extent
+  {
+    struct hash_elem start_elem;        /* In by_start. */
+    struct hash_elem end_elem;          /* In by_end. */
+    struct list_elem bucket_elem;       /* In buckets[]. */
+    block_sector_t start;               /* First free sector. */
+    block_sector_t end;                 /* Sector just past the run. */
+  };
+
+#define BUCKET_CNT 16                   /* Last holds runs >= 2**15. */
+
+static struct hash by_start;            /* Extents by start. */
+static struct hash by_end;              /* Extents by end. */
+static struct list buckets[BUCKET_CNT]; /* Extents by log2 of length. */
+static struct kmem_cache *extent_cache;
+static bool extents_incomplete;         /* Some free sectors left out? */
+
+/* Write-back.  A change to the bitmap marks the free map file
+   sectors it touches dirty, and only those are written, rather
+   than the whole bitmap.  They are written at once, as part of
+   the caller's journal operation; the journal's group commit
+   batches the disk writes. */
+static struct bitmap *dirty;            /* Dirty free map file sectors. */
+
+/* Sectors released since the last journal commit.  They are free
+   in the bitmap but not among the free extents, so that nothing
+   reuses them before the release is on disk. */
+static struct bitmap *released;
+
+/* Statistics. */
+static long long near_cnt, far_cnt, write_cnt;
+
+static unsigned
+start_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct free_extent, start_elem)->start);
+}
+
+static bool
+start_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct free_extent, start_elem)->start
+          < hash_entry (b, struct free_extent, start_elem)->start);
+}
+
+static unsigned
+end_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct free_extent, end_elem)->end);
+}
+
+static bool
+end_less (const struct hash_elem *a, const struct hash_elem *b,
+          void *aux UNUSED)
+{
+  return (hash_entry (a, struct free_extent, end_elem)->end
+          < hash_entry (b, struct free_extent, end_elem)->end);
+}
+
+/* Returns the bucket for a run of LENGTH sectors. */
+static struct list *
+bucket_for (size_t length)
+{
+  size_t b = 0;
+
+  ASSERT (length > 0);
+  while (length > 1 && b < BUCKET_CNT - 1)
+    {
+      length >>= 1;
+      b++;
+    }
+  return &buckets[b];
+}
+
+/* Adds X to the indexes. */
+static void
+insert_extent (struct free_extent *x)
+{
+  hash_insert (&by_start, &x->start_elem);
+  hash_insert (&by_end, &x->end_elem);
+  list_push_front (bucket_for (x->end - x->start), &x->bucket_elem);
+}
+
+/* Removes X from the indexes. */
+static void
+remove_extent (struct free_extent *x)
+{
+  hash_delete (&by_start, &x->start_elem);
+  hash_delete (&by_end, &x->end_elem);
+  list_remove (&x->bucket_elem);
+}
+
+/* Returns the extent starting at SECTOR, or a null pointer. */
+static struct free_extent *
+find_by_start (block_sector_t sector)
+{
+  struct free_extent key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  e = hash_find (&by_start, &key.start_elem);
+  return e != NULL ? hash_entry (e, struct free_extent, start_elem) : NULL;
+}
+
+/* Returns the extent ending just before SECTOR, or a null
+   pointer. */
+static struct free_extent *
+find_by_end (block_sector_t sector)
+{
+  struct free_extent key;
+  struct hash_elem *e;
+
+  key.end = sector;
+  e = hash_find (&by_end, &key.end_elem);
+  return e != NULL ? hash_entry (e, struct free_extent, end_elem) : NULL;
+}
+
+/* Returns an extent of at least CNT sectors, or a null pointer.
+   Looks in the bucket for CNT first, then in larger ones, so small
+   runs are used up before large ones are split. */
+static struct free_extent *
+find_by_length (size_t cnt)
+{
+  struct list *b;
+
+  for (b = bucket_for (cnt); b < buckets + BUCKET_CNT; b++)
+    {
+      struct list_elem *e;
+
+      for (e = list_begin (b); e != list_end (b); e = list_next (e))
+        {
+          struct free_extent *x = list_entry (e, struct free_extent,
+                                              bucket_elem);
+          if (x->end - x->start >= cnt)
+            return x;
+        }
+    }
+  return NULL;
+}
+
+/* Takes CNT sectors from the start of X and returns the first. */
+static block_sector_t
+take (struct free_extent *x, size_t cnt)
+{
+  block_sector_t sector = x->start;
+
+  remove_extent (x);
+  x->start += cnt;
+  if (x->start < x->end)
+    insert_extent (x);
+  else
+    kmem_cache_free (extent_cache, x);
+  return sector;
+}
+
+/* Adds the CNT free sectors starting at SECTOR to the extents,
+   merging them with the extents on either side. */
+static void
+give (block_sector_t sector, size_t cnt)
+{
+  struct free_extent *before = find_by_end (sector);
+  struct free_extent *after = find_by_start (sector + cnt);
+
+  if (before != NULL)
+    {
+      remove_extent (before);
+      before->end = sector + cnt;
+      if (after != NULL)
+        {
+          remove_extent (after);
+          before->end = after->end;
+          kmem_cache_free (extent_cache, after);
+        }
+      insert_extent (before);
+    }
+  else if (after != NULL)
+    {
+      remove_extent (after);
+      after->start = sector;
+      insert_extent (after);
+    }
+  else
+    {
+      struct free_extent *x = kmem_cache_alloc (extent_cache);
+      if (x == NULL)
+        {
+          extents_incomplete = true;
+          return;
+        }
+      x->start = sector;
+      x->end = sector + cnt;
+      insert_extent (x);
+    }
+}
+
+/* Gives the sectors from START up to END, which are free, to the
+   extents, except those released since the last commit. */
+static void
+give_committed (size_t start, size_t end)
+{
+  while (start < end)
+    {
+      size_t run = start;
+
+      while (run < end && !bitmap_test (released, run))
+        run++;
+      if (run > start)
+        give (start, run - start);
+      start = run + 1;
+    }
+}
+
+/* Discards the extents and rebuilds them from the bitmap. */
+static void
+build_extents (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t start, end;
+  int i;
+
+  for (i = 0; i < BUCKET_CNT; i++)
+    while (!list_empty (&buckets[i]))
+      {
+        struct free_extent *x = list_entry (list_pop_front (&buckets[i]),
+                                            struct free_extent, bucket_elem);
+        kmem_cache_free (extent_cache, x);
+      }
+  hash_clear (&by_start, NULL);
+  hash_clear (&by_end, NULL);
+  extents_incomplete = false;
+
+  for (start = bitmap_scan (free_map, 0, 1, false); start != BITMAP_ERROR;
+       start = end < size ? bitmap_scan (free_map, end, 1, false)
+                          : BITMAP_ERROR)
+    {
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = size;
+      give_committed (start, end);
+    }
+}
+
+/* Marks the free map file sectors that hold the bits for sectors
+   SECTOR through SECTOR + CNT - 1 dirty. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / 8 / BLOCK_SECTOR_SIZE;
+  size_t last = (sector + cnt - 1) / 8 / BLOCK_SECTOR_SIZE;
+
+  bitmap_set_multiple (dirty, first, last - first + 1, true);
+}
+
+/* Writes the dirty sectors of the free map file.  free_map_lock
+   must be held.  Returns true if successful. */
+static bool
+write_dirty (void)
+{
+  size_t file_size = bitmap_file_size (free_map);
+  size_t i;
+
+  if (free_map_file == NULL)
+    return true;
+  for (i = bitmap_scan (dirty, 0, 1, true); i != BITMAP_ERROR;
+       i = bitmap_scan (dirty, i, 1, true))
+    {
+      size_t ofs = i * BLOCK_SECTOR_SIZE;
+      size_t size = file_size - ofs < BLOCK_SECTOR_SIZE
+                    ? file_size - ofs : BLOCK_SECTOR_SIZE;
+
+      if (!bitmap_write_part (free_map, free_map_file, ofs, size))
+        return false;
+      bitmap_reset (dirty, i);
+      write_cnt++;
+    }
+  return true;
+}
+
+/* Records a change to the bitmap for sectors SECTOR through
+   SECTOR + CNT - 1 and writes the part of the free map that holds
+   it.  free_map_lock must be held. */
+static void
+changed (block_sector_t sector, size_t cnt)
+{
+  mark_dirty (sector, cnt);
+  if (!write_dirty ())
+    printf ("free map: write failed\n");
+}
+
 /* Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
 {
+  int i;
+
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+
+  dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                       BLOCK_SECTOR_SIZE));
+  released = bitmap_create (bitmap_size (free_map));
+  if (dirty == NULL || released == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+
+  hash_init (&by_start, start_hash, start_less, NULL);
+  hash_init (&by_end, end_hash, end_less, NULL);
+  for (i = 0; i < BUCKET_CNT; i++)
+    list_init (&buckets[i]);
+  extent_cache = kmem_cache_create ("free_extent",
+                                    sizeof (struct free_extent), NULL);
+  build_extents ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Like free_map_allocate(), but takes the sectors starting at HINT
+   if a run of CNT free sectors starts there, and otherwise any run
+   large enough.  Passing the sector right after an existing run
+   extends that run whenever the sector is free, which keeps files
+   written sequentially contiguous on disk. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t hint,
+                        block_sector_t *sectorp)
+{
+  struct free_extent *x;
+  bool success = false;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  x = find_by_start (hint);
+  if (x != NULL && x->end - x->start >= cnt)
+    near_cnt++;
+  else
+    {
+      x = find_by_length (cnt);
+      if (x == NULL && extents_incomplete)
+        {
+          build_extents ();
+          x = find_by_length (cnt);
+        }
+      if (x != NULL)
+        far_cnt++;
+    }
+
+  if (x != NULL)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      *sectorp = take (x, cnt);
+      ASSERT (bitmap_none (free_map, *sectorp, cnt));
+      bitmap_set_multiple (free_map, *sectorp, cnt, true);
+      changed (*sectorp, cnt);
+      success = true;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+  return success;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use, once
+   the journal operation in progress commits. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  bitmap_set_multiple (released, sector, cnt, true);
+  changed (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors released before the journal's last commit
+   available for allocation.  Called by the journal. */
+void
+free_map_commit (void)
+{
+  size_t size = bitmap_size (released);
+  size_t start, end;
+
+  lock_acquire (&free_map_lock);
+  for (start = bitmap_scan (released, 0, 1, true); start != BITMAP_ERROR;
+       start = end < size ? bitmap_scan (released, end, 1, true)
+                          : BITMAP_ERROR)
+    {
+      end = bitmap_scan (released, start, 1, false);
+      if (end == BITMAP_ERROR)
+        end = size;
+      bitmap_set_multiple (released, start, end - start, false);
+      give (start, end - start);
+    }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
-free_map_open (void) 
+free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty, false);
+  bitmap_set_all (released, false);
+  build_extents ();
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Closes the free map file.  Every change has been written to it
+   already. */
 void
-free_map_close (void) 
+free_map_close (void)
 {
   file_close (free_map_file);
 }
@@ -70,16 +466,69 @@ free_map_close (void)
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
+  struct file *file;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The file's sectors are allocated as
+     they are written, which changes the bitmap, so it is written
+     once more to record them.  free_map_allocate() must not write
+     the file while it is still being filled in. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty, false);
+}
+
+/* Compares the free map with USED, which marks every sector that
+   some inode uses, for fsck.  Reports each sector in use that the
+   free map calls free, and how many it calls in use that nothing
+   uses.  Returns the number of sectors in use but free. */
+size_t
+free_map_check (const struct bitmap *used)
+{
+  size_t size = bitmap_size (free_map);
+  size_t bad_cnt = 0, leaked_cnt = 0;
+  size_t i;
+
+  ASSERT (bitmap_size (used) == size);
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < size; i++)
+    {
+      bool in_use = (bitmap_test (used, i)
+                     || (i >= JOURNAL_SECTOR
+                         && i < JOURNAL_SECTOR + JOURNAL_SECTORS));
+      bool allocated = bitmap_test (free_map, i);
+
+      if (in_use && !allocated && bad_cnt++ < 10)
+        printf ("fsck: sector %zu is in use but free\n", i);
+      else if (!in_use && allocated)
+        leaked_cnt++;
+    }
+  lock_release (&free_map_lock);
+  if (leaked_cnt > 0)
+    printf ("fsck: %zu sectors allocated but unused\n", leaked_cnt);
+  return bad_cnt;
+}
+
+/* Prints free map statistics. */
+void
+free_map_print_stats (void)
+{
+  if (extent_cache == NULL)
+    return;
+  printf ("Free map: %zu free sectors in %zu extents, "
+          "%lld allocations at hint, %lld elsewhere, "
+          "%lld sectors written\n",
+          bitmap_count (free_map, 0, bitmap_size (free_map), false),
+          hash_size (&by_start), near_cnt, far_cnt, write_cnt);
 }
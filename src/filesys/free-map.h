@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include "devices/block.h"
 
+struct bitmap;
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
@@ -12,6 +14,10 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (size_t, block_sector_t, block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+void free_map_commit (void);
+size_t free_map_check (const struct bitmap *used);
+void free_map_print_stats (void);
 
 #endif /* filesys/free-map.h */
@@ -1,5 +1,7 @@
 #include "filesys/fsutil.h"
+#include <bitmap.h>
 #include <debug.h>
+#include <list.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +9,8 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -221,3 +225,110 @@ fsutil_append (char **argv)
   file_close (src);
   free (buffer);
 }
+
+/* A directory fsck has yet to read. */
+struct fsck_dir
+  {
+    struct list_elem elem;
+    block_sector_t sector;              /* Its inode sector. */
+  };
+
+/* Queues the directory in SECTOR for fsck to read. */
+static void
+fsck_queue (struct list *dirs, block_sector_t sector)
+{
+  struct fsck_dir *d = malloc (sizeof *d);
+  if (d == NULL)
+    PANIC ("fsck: out of memory");
+  d->sector = sector;
+  list_push_back (dirs, &d->elem);
+}
+
+/* Checks the file system: every directory entry must name a valid
+   inode, no sector may belong to two inodes, and every sector an
+   inode uses must be allocated in the free map.  Prints what is
+   wrong, and whether the file system is consistent. */
+void
+fsutil_fsck (char **argv UNUSED)
+{
+  struct bitmap *used;
+  struct list dirs;
+  struct inode *inode;
+  size_t file_cnt = 0, dir_cnt = 0, bad_cnt = 0;
+
+  used = bitmap_create (block_size (fs_device));
+  if (used == NULL)
+    PANIC ("fsck: out of memory");
+  list_init (&dirs);
+
+  inode = inode_open (FREE_MAP_SECTOR);
+  if (inode == NULL || !inode_mark_sectors (inode, used))
+    {
+      printf ("fsck: free map inode is bad\n");
+      bad_cnt++;
+    }
+  inode_close (inode);
+
+  inode = inode_open (ROOT_DIR_SECTOR);
+  if (inode == NULL || !inode_mark_sectors (inode, used))
+    {
+      printf ("fsck: root directory inode is bad\n");
+      bad_cnt++;
+    }
+  else
+    fsck_queue (&dirs, ROOT_DIR_SECTOR);
+  inode_close (inode);
+
+  /* Walk the tree breadth first.  Each inode is marked when its
+     entry is found, so one found twice, through a second entry or
+     a cycle, is reported instead of walked again. */
+  while (!list_empty (&dirs))
+    {
+      struct fsck_dir *d = list_entry (list_pop_front (&dirs),
+                                       struct fsck_dir, elem);
+      struct dir *dir = dir_open (inode_open (d->sector));
+      char name[NAME_MAX + 1];
+
+      if (dir == NULL)
+        {
+          printf ("fsck: directory %"PRDSNu" cannot be opened\n",
+                  d->sector);
+          bad_cnt++;
+          free (d);
+          continue;
+        }
+      dir_cnt++;
+      while (dir_readdir (dir, name))
+        {
+          if (!dir_lookup (dir, name, &inode))
+            {
+              printf ("fsck: \"%s\" in directory %"PRDSNu" cannot be "
+                      "opened\n", name, d->sector);
+              bad_cnt++;
+            }
+          else if (!inode_mark_sectors (inode, used))
+            {
+              printf ("fsck: \"%s\" in directory %"PRDSNu": bad inode %"
+                      PRDSNu" or sectors used twice\n",
+                      name, d->sector, inode_get_inumber (inode));
+              bad_cnt++;
+            }
+          else if (inode_is_dir (inode))
+            fsck_queue (&dirs, inode_get_inumber (inode));
+          else
+            file_cnt++;
+          inode_close (inode);
+        }
+      dir_close (dir);
+      free (d);
+    }
+
+  bad_cnt += free_map_check (used);
+  bitmap_destroy (used);
+
+  printf ("fsck: %zu files, %zu directories\n", file_cnt, dir_cnt);
+  if (bad_cnt == 0)
+    printf ("fsck: file system is consistent\n");
+  else
+    printf ("fsck: %zu problems found\n", bad_cnt);
+}
@@ -1,77 +1,376 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
 #include <round.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Largest file, in sectors: 8 MB. */
+#define MAX_SECTORS (8 * 1024 * 1024 / BLOCK_SECTOR_SIZE)
+
+/* A run of LENGTH consecutive disk sectors starting at START that
+   holds the file's sectors starting at OFS. */
+struct extent
+  {
+    uint32_t ofs;                       /* First file sector. */
+    block_sector_t start;               /* First disk sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Extents kept in the inode, and in each overflow block. */
+#define INLINE_EXTENTS 41
+#define BLOCK_EXTENTS 42
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The file's sectors are found through its extents.  The first
+   INLINE_EXTENTS are kept here, the rest in a chain of overflow
+   blocks.  Extents are in the order they were created, which for
+   a file written sequentially is file order.  File sectors that
+   no extent covers have not been allocated: they read as zeros
+   and are allocated by the first write to them. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Extents, inline and overflow. */
+    block_sector_t overflow;            /* First overflow block, or 0. */
+    struct extent extents[INLINE_EXTENTS]; /* First extents. */
+    uint32_t is_dir;                    /* 1 for a directory, 0 if not. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
+/* Overflow block of extents.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    block_sector_t next;                /* Next overflow block, or 0. */
+    uint32_t unused;                    /* Not used. */
+    struct extent extents[BLOCK_EXTENTS]; /* Extents. */
+  };
+
+/* Where a lookup found an extent last, so that the next lookup
+   can start there. */
+struct extent_cursor
+  {
+    struct extent extent;               /* The extent, if length > 0. */
+    size_t slot;                        /* Its index among the extents. */
+  };
+
+/* In-memory inode.
 
-/* In-memory inode. */
+   RW is held for reading while reading the file's data and its
+   extents, and for writing while writing data, which may allocate
+   sectors, add extents and grow the file.  So any number of
+   threads can read one file at once, and threads using different
+   files never wait for each other. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    bool loading;                       /* DATA not read from disk yet? */
+    struct condition loaded;            /* Signaled when LOADING clears. */
+    struct rwlock rw;                   /* Readers/writer of the data. */
+    struct extent_cursor cursor;        /* Extent the last writer used. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Sector of zeros, for new sectors. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Allocates a sector, preferably HINT, fills it with zeros and
+   stores its number into *SECTORP.  Returns true if successful,
+   false if the disk is full.  The zeros bypass the journal but
+   are ordered before the allocation commits, so that a crash
+   cannot leave the sector in a file with the contents it had
+   before it was freed. */
+static bool
+allocate_zeroed (block_sector_t hint, block_sector_t *sectorp)
+{
+  if (!free_map_allocate_near (1, hint, sectorp))
+    return false;
+  cache_write (*sectorp, zeros);
+  journal_order (*sectorp);
+  return true;
+}
+
+/* Returns true if extent E holds file sector IDX. */
+static inline bool
+extent_contains (const struct extent *e, uint32_t idx)
+{
+  return idx >= e->ofs && idx - e->ofs < e->length;
+}
+
+/* Finds the extent of INODE that holds file sector IDX, and
+   stores it into *EP and its index into *SLOTP.  Returns false if
+   IDX has not been allocated.  Starts at CURSOR and leaves it at
+   the extent found.  Readers each have a cursor of their own;
+   writers use INODE's. */
+static bool
+find_extent (struct inode *inode, uint32_t idx, struct extent_cursor *cursor,
+             struct extent *ep, size_t *slotp)
+{
+  const struct inode_disk *d = &inode->data;
+  block_sector_t block = d->overflow;
+  size_t i;
+
+  /* Sequential access stays within the extent it used last. */
+  if (cursor->extent.length > 0 && extent_contains (&cursor->extent, idx))
+    {
+      *ep = cursor->extent;
+      *slotp = cursor->slot;
+      return true;
+    }
+
+  for (i = 0; i < d->extent_cnt && i < INLINE_EXTENTS; i++)
+    if (extent_contains (&d->extents[i], idx))
+      {
+        *ep = d->extents[i];
+        goto found;
+      }
+
+  while (i < d->extent_cnt)
+    {
+      const struct extent_block *b = cache_get (block, CACHE_READ);
+      size_t j;
+
+      for (j = 0; j < BLOCK_EXTENTS && i < d->extent_cnt; j++, i++)
+        if (extent_contains (&b->extents[j], idx))
+          {
+            *ep = b->extents[j];
+            cache_put ((void *) b, false);
+            goto found;
+          }
+      block = b->next;
+      cache_put ((void *) b, false);
+    }
+  return false;
+
+ found:
+  *slotp = i;
+  cursor->extent = *ep;
+  cursor->slot = i;
+  return true;
+}
+
+/* Writes E as extent SLOT of INODE.  SLOT may be one past the
+   last extent, to add one; the overflow block for it is allocated
+   if needed.  Returns true if successful, false if the disk is
+   full. */
+static bool
+store_extent (struct inode *inode, size_t slot, const struct extent *e)
+{
+  struct inode_disk *d = &inode->data;
+
+  ASSERT (slot <= d->extent_cnt);
+
+  if (slot >= INLINE_EXTENTS)
+    {
+      size_t n = (slot - INLINE_EXTENTS) / BLOCK_EXTENTS;
+      size_t j = (slot - INLINE_EXTENTS) % BLOCK_EXTENTS;
+      block_sector_t block;
+
+      if (d->overflow == 0)
+        {
+          if (!allocate_zeroed (inode->sector, &d->overflow))
+            return false;
+          journal_write (inode->sector, d);
+        }
+      for (block = d->overflow; n > 0; n--)
+        {
+          block_sector_t next;
+
+          cache_read_at (block, &next, offsetof (struct extent_block, next),
+                         sizeof next);
+          if (next == 0)
+            {
+              if (!allocate_zeroed (block, &next))
+                return false;
+              journal_write_at (block, &next,
+                                offsetof (struct extent_block, next),
+                                sizeof next);
+            }
+          block = next;
+        }
+      journal_write_at (block, e, offsetof (struct extent_block, extents)
+                        + j * sizeof *e, sizeof *e);
+    }
+  else
+    d->extents[slot] = *e;
+
+  if (slot == d->extent_cnt)
+    {
+      d->extent_cnt++;
+      journal_write (inode->sector, d);
+    }
+  else if (slot < INLINE_EXTENTS)
+    journal_write (inode->sector, d);
+
+  inode->cursor.extent = *e;
+  inode->cursor.slot = slot;
+  return true;
+}
+
+/* Allocates a sector for file sector IDX of INODE, which has none.
+   It is placed right after the sector for IDX - 1 if that one is
+   free, so that the run holding IDX - 1 just grows by one, or as
+   close after it as possible otherwise.  Returns the new sector,
+   or 0 if the disk is full. */
+static block_sector_t
+allocate_sector (struct inode *inode, uint32_t idx)
+{
+  struct extent prev, e;
+  size_t prev_slot;
+  block_sector_t hint, sector;
+  bool have_prev = idx > 0 && find_extent (inode, idx - 1, &inode->cursor,
+                                           &prev, &prev_slot);
+
+  hint = have_prev ? prev.start + prev.length : inode->sector + 1;
+  if (!allocate_zeroed (hint, &sector))
+    return 0;
+
+  if (have_prev && sector == hint)
+    {
+      prev.length++;
+      if (store_extent (inode, prev_slot, &prev))
+        return sector;
+    }
+  else
+    {
+      e.ofs = idx;
+      e.start = sector;
+      e.length = 1;
+      if (store_extent (inode, inode->data.extent_cnt, &e))
+        return sector;
+    }
+  free_map_release (sector, 1);
+  return 0;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, looking it up from CURSOR.
+   Returns 0 if that sector has not been allocated, unless ALLOCATE
+   is true, in which case it is allocated; then CURSOR must be
+   INODE's own and INODE's lock held for writing.  Also returns 0
+   if POS is past the largest file size or the disk is full. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, struct extent_cursor *cursor,
+                bool allocate)
 {
+  uint32_t idx;
+  struct extent e;
+  size_t slot;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  ASSERT (pos >= 0);
+
+  idx = pos / BLOCK_SECTOR_SIZE;
+  if (idx >= MAX_SECTORS)
+    return 0;
+  if (find_extent (inode, idx, cursor, &e, &slot))
+    return e.start + (idx - e.ofs);
+  return allocate ? allocate_sector (inode, idx) : 0;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Frees all the sectors of INODE: its data, its overflow blocks
+   and its own sector. */
+static void
+release_sectors (struct inode *inode)
+{
+  const struct inode_disk *d = &inode->data;
+  block_sector_t block = d->overflow;
+  size_t i;
+
+  for (i = 0; i < d->extent_cnt && i < INLINE_EXTENTS; i++)
+    free_map_release (d->extents[i].start, d->extents[i].length);
+  while (block != 0)
+    {
+      const struct extent_block *b = cache_get (block, CACHE_READ);
+      block_sector_t next = b->next;
+      size_t j;
+
+      for (j = 0; j < BLOCK_EXTENTS && i < d->extent_cnt; j++, i++)
+        free_map_release (b->extents[j].start, b->extents[j].length);
+      cache_put ((void *) b, false);
+      free_map_release (block, 1);
+      block = next;
+    }
+  free_map_release (inode->sector, 1);
+}
+
+/* Open inodes by sector, so that opening a single inode twice
+   returns the same `struct inode'.  open_inodes_lock protects the
+   table and the open counts of the inodes in it. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+/* In-memory inodes come from here. */
+static struct kmem_cache *inode_cache;
+
+/* Statistics. */
+static long long open_hit_cnt, open_miss_cnt;
+static size_t open_peak;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* Returns the open inode for SECTOR, or a null pointer.
+   open_inodes_lock must be held. */
+static struct inode *
+find_open (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), NULL);
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   device.
+/* Initializes an inode with LENGTH bytes of data, for a
+   directory if IS_DIR is true, and writes the new inode to
+   sector SECTOR on the file system device.  No data sectors are
+   allocated yet: the data reads as zeros until it is written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is larger
+   than the largest file. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -81,27 +380,20 @@ inode_create (block_sector_t sector, off_t length)
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
+
+  if (length > (off_t) MAX_SECTORS * BLOCK_SECTOR_SIZE)
+    return false;
 
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      disk_inode->is_dir = is_dir;
+      journal_write (sector, disk_inode);
       free (disk_inode);
+      success = true;
     }
   return success;
 }
@@ -112,33 +404,54 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+  inode = find_open (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode->open_cnt++;
+      open_hit_cnt++;
+      while (inode->loading)
+        cond_wait (&inode->loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode;
     }
+  open_miss_cnt++;
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is entered as loading and the disk
+     inode is read without the lock, so that opens and closes of
+     other inodes need not wait for the disk.  Other openers of
+     this one wait until it is read, so that nobody can change it
+     meanwhile. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->loading = true;
+  cond_init (&inode->loaded);
+  rwlock_init (&inode->rw);
+  inode->cursor.extent.length = 0;
+  hash_insert (&open_inodes, &inode->elem);
+  if (hash_size (&open_inodes) > open_peak)
+    open_peak = hash_size (&open_inodes);
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -147,7 +460,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -164,25 +481,30 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          journal_begin ();
+          release_sectors (inode);
+          journal_end ();
         }
 
-      free (inode); 
+      kmem_cache_free (inode_cache, inode);
     }
 }
 
@@ -195,20 +517,47 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns true if INODE's data is file system metadata, which is
+   written through the journal: a directory or the free map. */
+static bool
+is_metadata (const struct inode *inode)
+{
+  return inode_is_dir (inode) || inode->sector == FREE_MAP_SECTOR;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   BUFFER must be kernel memory: a page fault on a user buffer here
+   could need this inode's lock or a cache entry held meanwhile. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
-  
+  struct extent_cursor cursor;
+
+  rwlock_read_acquire (&inode->rw);
+  cursor = inode->cursor;
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, &cursor,
+                                                  false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -221,91 +570,98 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy straight out of the cached sector.  A sector that was
+         never written reads as zeros. */
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_read_release (&inode->rw);
 
   return bytes_read;
 }
 
+/* Asks for the sectors holding the SIZE bytes of INODE at OFFSET
+   to be read into the buffer cache in the background.  Stops at
+   end of file, and skips sectors that were never written. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  struct extent_cursor cursor;
+
+  rwlock_read_acquire (&inode->rw);
+  cursor = inode->cursor;
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset -= offset % BLOCK_SECTOR_SIZE; offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset, &cursor, false);
+      if (sector != 0)
+        cache_prefetch (sector);
+    }
+  rwlock_read_release (&inode->rw);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up, the largest file size is
+   reached or an error occurs.
+   A write past end of file extends the inode.  Sectors are
+   allocated as they are written, so skipping over a range leaves
+   a hole that takes no disk space.
+   BUFFER must be kernel memory, as for inode_read_at().
+   The write is one journal operation.  The data of directories
+   and of the free map goes through the journal; that of ordinary
+   files is written in place, but reaches the disk before the
+   operation commits. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
+  journal_begin ();
+  rwlock_write_acquire (&inode->rw);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_write_release (&inode->rw);
+      journal_end ();
+      return 0;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset,
+                                                  &inode->cursor, true);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector, lesser of that and SIZE. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Copy straight into the cached sector.  It is read from disk
+         first unless the chunk covers all of it. */
+      if (is_metadata (inode))
+        journal_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                          chunk_size);
+      else
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                          chunk_size);
+          journal_order (sector_idx);
         }
 
       /* Advance. */
@@ -313,7 +669,15 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file once the new data is in place. */
+  if (bytes_written > 0 && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      journal_write (inode->sector, &inode->data);
+    }
+  rwlock_write_release (&inode->rw);
+  journal_end ();
 
   return bytes_written;
 }
@@ -323,8 +687,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_write_acquire (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_write_release (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -333,9 +699,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_write_acquire (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_write_release (&inode->rw);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -344,3 +712,65 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Marks sectors START through START + CNT - 1 in USED.  Returns
+   false if any of them is off the disk or was marked already. */
+static bool
+mark_used (struct bitmap *used, block_sector_t start, size_t cnt)
+{
+  bool ok;
+
+  if (start >= bitmap_size (used) || cnt > bitmap_size (used) - start)
+    return false;
+  ok = bitmap_none (used, start, cnt);
+  bitmap_set_multiple (used, start, cnt, true);
+  return ok;
+}
+
+/* Marks every sector INODE uses in USED: its own, its overflow
+   blocks and its data.  Returns false if INODE is not a valid
+   inode or uses a sector that was marked already. */
+bool
+inode_mark_sectors (struct inode *inode, struct bitmap *used)
+{
+  const struct inode_disk *d = &inode->data;
+  block_sector_t block = d->overflow;
+  bool ok;
+  size_t i;
+
+  if (d->magic != INODE_MAGIC)
+    return false;
+  ok = mark_used (used, inode->sector, 1);
+  for (i = 0; i < d->extent_cnt && i < INLINE_EXTENTS; i++)
+    ok = mark_used (used, d->extents[i].start, d->extents[i].length) && ok;
+  while (block != 0 && ok)
+    {
+      const struct extent_block *b;
+      block_sector_t next;
+      size_t j;
+
+      if (!mark_used (used, block, 1))
+        return false;
+      b = cache_get (block, CACHE_READ);
+      for (j = 0; j < BLOCK_EXTENTS && i < d->extent_cnt; j++, i++)
+        ok = mark_used (used, b->extents[j].start, b->extents[j].length) && ok;
+      next = b->next;
+      cache_put ((void *) b, false);
+      block = next;
+    }
+  return ok && i == d->extent_cnt;
+}
+
+/* Prints open-inode table statistics. */
+void
+inode_print_stats (void)
+{
+  long long total = open_hit_cnt + open_miss_cnt;
+
+  if (inode_cache == NULL)
+    return;
+  printf ("Open inodes: %zu now, %zu at peak, %lld opens found open, "
+          "%lld read from disk (%lld%% hit ratio)\n",
+          hash_size (&open_inodes), open_peak, open_hit_cnt, open_miss_cnt,
+          total > 0 ? open_hit_cnt * 100 / total : 0);
+}
@@ -0,0 +1,406 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Metadata journal.  Inodes, extent blocks, directories and the
+   free map are changed through journal_write(), not in place: the
+   sectors are modified in the buffer cache and held there, never
+   written back, until the transaction they belong to commits.
+   File data is not journaled, but it is ordered: see
+   journal_order().
+
+   Every file system operation that changes metadata runs between
+   journal_begin() and journal_end().  All operations started since
+   the last commit form one transaction, which commits as a whole
+   once a second, when it would grow too large, or at shutdown.
+   That is group commit: one commit covers many operations.
+
+   A commit writes the new contents of every sector of the
+   transaction to the log area, then the descriptor listing where
+   they belong, then the header with their count.  Writing the
+   header is the commit point.  Then the sectors are written in
+   place and the header is cleared.  If the power fails before the
+   header is written, the transaction is lost as a whole; if after,
+   journal_init() copies the log into place again at the next
+   mount.  Either way every operation took effect completely or
+   not at all.
+
+   A commit first writes the sectors given to journal_order(), the
+   file data the transaction wrote or allocated, so that once an
+   operation has committed its data is on disk as well, and
+   committed metadata never points to a sector that still holds
+   what it held before it was last freed.
+
+   Sectors released by a transaction are not reused before it
+   commits, see free_map_release(), or a crash could leave them
+   referenced by metadata that was never updated on disk.
+
+   The transaction can hold at most half of the buffer cache,
+   since its sectors cannot be evicted, and at most LOG_SECTORS.
+   Each operation in progress reserves room for HANDLE_SECTORS.  An
+   operation that needs more than is left writes the rest in
+   place, losing atomicity but not its data. */
+
+/* Commit period, in timer ticks. */
+#define COMMIT_INTERVAL TIMER_FREQ
+
+/* Sectors of log, after the header and the descriptor. */
+#define LOG_SECTORS (JOURNAL_SECTORS - 2)
+
+/* Sectors one operation is expected to change. */
+#define HANDLE_SECTORS 8
+
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Journal header, in sector JOURNAL_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    uint32_t magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Transaction number. */
+    uint32_t cnt;                       /* Sectors logged, 0 if none. */
+    uint32_t unused[125];               /* Not used. */
+  };
+
+/* Journal descriptor, in sector JOURNAL_SECTOR + 1: where each
+   logged sector belongs.  Must be exactly BLOCK_SECTOR_SIZE bytes
+   long. */
+struct journal_descriptor
+  {
+    block_sector_t home[LOG_SECTORS];   /* Home of each log sector. */
+    uint32_t unused[128 - LOG_SECTORS]; /* Not used. */
+  };
+
+static struct lock journal_lock;        /* Protects all below. */
+static struct condition changed;        /* Handle ended or commit done. */
+static int handle_cnt;                  /* Operations in progress. */
+static bool commit_wanted;              /* No new handles until commit. */
+static uint32_t seq;                    /* Running transaction's number. */
+static size_t max_cnt;                  /* Largest transaction. */
+
+/* The running transaction. */
+static struct journal_descriptor descriptor;
+static size_t logged_cnt;               /* Sectors logged so far. */
+static struct bitmap *logged;           /* Which sectors, by number. */
+static struct bitmap *ordered;          /* Data sectors to write first. */
+static size_t ordered_cnt;              /* Bits set in ordered. */
+
+/* Statistics. */
+static long long commit_cnt, op_cnt, log_write_cnt, overflow_cnt;
+static long long order_write_cnt;
+static size_t replay_cnt;
+
+static void clear_header (void);
+static void committer (void *aux);
+
+/* Copies the transaction in the log, if it committed, into place,
+   and empties the log.  Called at mount, before anything else reads
+   the disk. */
+static void
+replay (void)
+{
+  struct journal_header h;
+  size_t i;
+
+  block_read (fs_device, JOURNAL_SECTOR, &h);
+  if (h.magic != JOURNAL_MAGIC)
+    PANIC ("no journal: reformat with -f");
+  seq = h.seq + 1;
+  if (h.cnt == 0)
+    return;
+  if (h.cnt > LOG_SECTORS)
+    PANIC ("journal header is corrupt");
+
+  block_read (fs_device, JOURNAL_SECTOR + 1, &descriptor);
+  for (i = 0; i < h.cnt; i++)
+    {
+      uint8_t buffer[BLOCK_SECTOR_SIZE];
+      block_read (fs_device, JOURNAL_SECTOR + 2 + i, buffer);
+      block_write (fs_device, descriptor.home[i], buffer);
+    }
+  replay_cnt = h.cnt;
+
+  /* Empty the log before it is reused.  The next commit writes log
+     sectors and the descriptor before its header, and while this
+     header still counted them a power failure would replay those
+     onto the old homes. */
+  clear_header ();
+  printf ("journal: replayed transaction %u, %u sectors\n",
+          (unsigned) h.seq, (unsigned) h.cnt);
+}
+
+/* Writes an empty journal header. */
+static void
+clear_header (void)
+{
+  static struct journal_header h;
+
+  h.magic = JOURNAL_MAGIC;
+  h.seq = seq;
+  h.cnt = 0;
+  block_write (fs_device, JOURNAL_SECTOR, &h);
+}
+
+/* Initializes the journal.  If FORMAT is false, first completes a
+   transaction that committed before the file system went down.
+   Must be called before any other file system module reads the
+   disk. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_descriptor) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&changed);
+  logged = bitmap_create (block_size (fs_device));
+  ordered = bitmap_create (block_size (fs_device));
+  if (logged == NULL || ordered == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  max_cnt = cache_size / 2 < LOG_SECTORS ? cache_size / 2 : LOG_SECTORS;
+
+  if (format)
+    {
+      seq = 1;
+      clear_header ();
+    }
+  else
+    replay ();
+  thread_create ("committer", PRI_DEFAULT, committer, NULL);
+}
+
+/* Writes the sectors given to journal_order() to disk.
+   journal_lock must be held. */
+static void
+write_ordered (void)
+{
+  size_t sector = 0;
+
+  while (ordered_cnt > 0)
+    {
+      sector = bitmap_scan_and_flip (ordered, sector, 1, true);
+      ASSERT (sector != BITMAP_ERROR);
+      cache_flush_sector (sector);
+      ordered_cnt--;
+      order_write_cnt++;
+    }
+}
+
+/* Commits the running transaction.  journal_lock must be held and
+   no handle may be open. */
+static void
+commit_locked (void)
+{
+  struct journal_header h;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (handle_cnt == 0);
+
+  /* Data first: the metadata about to commit may point to it. */
+  write_ordered ();
+
+  if (logged_cnt > 0)
+    {
+      /* Log the sectors, then say where they go, then commit. */
+      for (i = 0; i < logged_cnt; i++)
+        {
+          uint8_t buffer[BLOCK_SECTOR_SIZE];
+          cache_read (descriptor.home[i], buffer);
+          block_write (fs_device, JOURNAL_SECTOR + 2 + i, buffer);
+        }
+      block_write (fs_device, JOURNAL_SECTOR + 1, &descriptor);
+      memset (&h, 0, sizeof h);
+      h.magic = JOURNAL_MAGIC;
+      h.seq = seq;
+      h.cnt = logged_cnt;
+      block_write (fs_device, JOURNAL_SECTOR, &h);
+
+      /* Checkpoint: write them in place, then empty the log so
+         that the next transaction can overwrite it. */
+      for (i = 0; i < logged_cnt; i++)
+        {
+          cache_checkpoint (descriptor.home[i]);
+          bitmap_reset (logged, descriptor.home[i]);
+        }
+      seq++;
+      clear_header ();
+
+      log_write_cnt += logged_cnt;
+      logged_cnt = 0;
+      commit_cnt++;
+
+      /* What the transaction released may be used now. */
+      free_map_commit ();
+    }
+  commit_wanted = false;
+  cond_broadcast (&changed, &journal_lock);
+}
+
+/* Waits for the operations in progress to end, keeping new ones
+   from starting, and commits the running transaction.
+   journal_lock must be held. */
+static void
+commit_when_idle (void)
+{
+  while (handle_cnt > 0)
+    {
+      commit_wanted = true;
+      cond_wait (&changed, &journal_lock);
+    }
+  commit_locked ();
+}
+
+/* Commits every operation that has ended.  The caller must not be
+   in an operation. */
+void
+journal_commit (void)
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  commit_when_idle ();
+  lock_release (&journal_lock);
+}
+
+/* Commits what is left at shutdown. */
+void
+journal_done (void)
+{
+  journal_commit ();
+}
+
+/* Starts an operation that changes metadata, which ends at the
+   matching journal_end().  Operations nest: only the outermost one
+   counts.  May wait for a commit, so the outermost call must come
+   before taking any file system lock. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (commit_wanted
+         || (logged_cnt > 0
+             && logged_cnt + (handle_cnt + 1) * HANDLE_SECTORS > max_cnt))
+    {
+      if (handle_cnt == 0)
+        commit_locked ();
+      else
+        {
+          commit_wanted = true;
+          cond_wait (&changed, &journal_lock);
+        }
+    }
+  handle_cnt++;
+  op_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation started by journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (--handle_cnt == 0)
+    cond_broadcast (&changed, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Writes BUFFER, BLOCK_SECTOR_SIZE bytes, to metadata SECTOR as
+   part of the running transaction. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  journal_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of metadata SECTOR
+   as part of the running transaction. */
+void
+journal_write_at (block_sector_t sector, const void *buffer,
+                  size_t ofs, size_t size)
+{
+  bool log;
+
+  journal_begin ();
+  lock_acquire (&journal_lock);
+  log = bitmap_test (logged, sector);
+  if (!log && logged_cnt < max_cnt)
+    {
+      bitmap_mark (logged, sector);
+      descriptor.home[logged_cnt++] = sector;
+      log = true;
+    }
+  else if (!log)
+    overflow_cnt++;
+  lock_release (&journal_lock);
+
+  if (log)
+    cache_write_logged (sector, buffer, ofs, size);
+  else
+    cache_write_at (sector, buffer, ofs, size);
+  journal_end ();
+}
+
+/* Makes SECTOR, file data just written or allocated, reach the
+   disk before the running transaction commits.  Must be called in
+   an operation, after SECTOR has been written. */
+void
+journal_order (block_sector_t sector)
+{
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  if (!bitmap_test (ordered, sector))
+    {
+      bitmap_mark (ordered, sector);
+      ordered_cnt++;
+    }
+  lock_release (&journal_lock);
+}
+
+/* Commit thread. */
+static void
+committer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (COMMIT_INTERVAL);
+      lock_acquire (&journal_lock);
+      if (logged_cnt > 0 || ordered_cnt > 0)
+        commit_when_idle ();
+      lock_release (&journal_lock);
+    }
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  if (logged == NULL)
+    return;
+  printf ("Journal: %lld operations in %lld commits, %lld sectors logged, "
+          "%lld written unlogged, %lld data sectors ordered, "
+          "%zu replayed\n", op_cnt, commit_cnt, log_write_cnt,
+          overflow_cnt, order_write_cnt, replay_cnt);
+}
@@ -0,0 +1,25 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Reserved area of the file system device that holds the
+   journal: a header, a descriptor and the logged sectors. */
+#define JOURNAL_SECTOR 2                /* First sector, the header. */
+#define JOURNAL_SECTORS 128             /* Sectors in the area. */
+
+void journal_init (bool format);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_write (block_sector_t, const void *buffer);
+void journal_write_at (block_sector_t, const void *buffer,
+                       size_t ofs, size_t size);
+void journal_order (block_sector_t);
+void journal_commit (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -358,6 +358,19 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes bytes OFS through OFS + SIZE - 1 of B's file image to the
+   same place in FILE, for updating part of a bitmap written by
+   bitmap_write().  Return true if successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  ASSERT (ofs <= byte_cnt (b->bit_cnt));
+  ASSERT (size <= byte_cnt (b->bit_cnt) - ofs);
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+         == (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data0) = random_bytes (96 * 512);
+my ($data1) = random_bytes (96 * 512);
+my ($data2) = random_bytes (96 * 512);
+my ($data3) = random_bytes (96 * 512);
+check_archive ({"child-bench-read" => "tests/filesys/extended/child-bench-read",
+		"data0" => [$data0], "data1" => [$data1],
+		"data2" => [$data2], "data3" => [$data3]});
+pass;
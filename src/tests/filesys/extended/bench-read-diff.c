@@ -0,0 +1,15 @@
+/* Has several processes each read a file of its own, larger than
+   the buffer cache, over and over at the same time.  Readers of
+   different files share nothing but the cache and the disk, so
+   compare the "Timer: N ticks" line printed at shutdown against
+   bench-read and against a kernel that serializes all file system
+   calls. */
+
+#include "tests/filesys/extended/bench-read.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  bench_read (CHILD_CNT);
+}
@@ -0,0 +1,34 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(bench-read-diff) begin
+(bench-read-diff) create "data0"
+(bench-read-diff) open "data0"
+(bench-read-diff) write "data0"
+(bench-read-diff) close "data0"
+(bench-read-diff) create "data1"
+(bench-read-diff) open "data1"
+(bench-read-diff) write "data1"
+(bench-read-diff) close "data1"
+(bench-read-diff) create "data2"
+(bench-read-diff) open "data2"
+(bench-read-diff) write "data2"
+(bench-read-diff) close "data2"
+(bench-read-diff) create "data3"
+(bench-read-diff) open "data3"
+(bench-read-diff) write "data3"
+(bench-read-diff) close "data3"
+(bench-read-diff) exec child 1 of 4: "child-bench-read 0 0"
+(bench-read-diff) exec child 2 of 4: "child-bench-read 1 1"
+(bench-read-diff) exec child 3 of 4: "child-bench-read 2 2"
+(bench-read-diff) exec child 4 of 4: "child-bench-read 3 3"
+(bench-read-diff) wait for child 1 of 4 returned 0 (expected 0)
+(bench-read-diff) wait for child 2 of 4 returned 1 (expected 1)
+(bench-read-diff) wait for child 3 of 4 returned 2 (expected 2)
+(bench-read-diff) wait for child 4 of 4 returned 3 (expected 3)
+(bench-read-diff) end
+EOF
+pass;
@@ -0,0 +1,46 @@
+/* Writes FILE_CNT files, then has CHILD_CNT processes read them
+   over and over at the same time, child I reading file I modulo
+   FILE_CNT.  The files come one after another from the random
+   stream seeded with 0, so that the children and the checks can
+   regenerate their contents. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/extended/bench-read.h"
+#include "tests/lib.h"
+
+static char buf[BUF_SIZE];
+
+void
+bench_read (int file_cnt) 
+{
+  pid_t children[CHILD_CNT];
+  int i;
+
+  random_init (0);
+  for (i = 0; i < file_cnt; i++)
+    {
+      char file_name[16];
+      int fd;
+
+      snprintf (file_name, sizeof file_name, "data%d", i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      random_bytes (buf, sizeof buf);
+      CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+             "write \"%s\"", file_name);
+      msg ("close \"%s\"", file_name);
+      close (fd);
+    }
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      char cmd_line[128];
+      snprintf (cmd_line, sizeof cmd_line, "child-bench-read %d %d",
+                i, i % file_cnt);
+      CHECK ((children[i] = exec (cmd_line)) != PID_ERROR,
+             "exec child %d of %d: \"%s\"", i + 1, CHILD_CNT, cmd_line);
+    }
+  wait_children (children, CHILD_CNT);
+}
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_archive ({"child-bench-read" => "tests/filesys/extended/child-bench-read",
+		"data0" => [random_bytes (96 * 512)]});
+pass;
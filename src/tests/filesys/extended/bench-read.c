@@ -0,0 +1,14 @@
+/* Has several processes read one file, larger than the buffer
+   cache, over and over at the same time.  Readers of one file no
+   longer wait for each other, so compare the "Timer: N ticks"
+   line printed at shutdown against a kernel that serializes all
+   file system calls. */
+
+#include "tests/filesys/extended/bench-read.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  bench_read (1);
+}
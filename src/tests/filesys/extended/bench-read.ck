@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(bench-read) begin
+(bench-read) create "data0"
+(bench-read) open "data0"
+(bench-read) write "data0"
+(bench-read) close "data0"
+(bench-read) exec child 1 of 4: "child-bench-read 0 0"
+(bench-read) exec child 2 of 4: "child-bench-read 1 0"
+(bench-read) exec child 3 of 4: "child-bench-read 2 0"
+(bench-read) exec child 4 of 4: "child-bench-read 3 0"
+(bench-read) wait for child 1 of 4 returned 0 (expected 0)
+(bench-read) wait for child 2 of 4 returned 1 (expected 1)
+(bench-read) wait for child 3 of 4 returned 2 (expected 2)
+(bench-read) wait for child 4 of 4 returned 3 (expected 3)
+(bench-read) end
+EOF
+pass;
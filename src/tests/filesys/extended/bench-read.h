@@ -0,0 +1,14 @@
+#ifndef TESTS_FILESYS_EXTENDED_BENCH_READ_H
+#define TESTS_FILESYS_EXTENDED_BENCH_READ_H
+
+/* Each file is half again as large as the 64-sector buffer cache,
+   so that every pass over it goes to the disk. */
+#define CHUNK_SIZE 512
+#define CHUNK_CNT 96
+#define BUF_SIZE (CHUNK_SIZE * CHUNK_CNT)
+#define PASS_CNT 4
+#define CHILD_CNT 4
+
+void bench_read (int file_cnt);
+
+#endif /* tests/filesys/extended/bench-read.h */
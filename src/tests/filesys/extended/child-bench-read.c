@@ -0,0 +1,56 @@
+/* Child process for bench-read and bench-read-diff.
+   Reads file "data<N>" written by our parent process PASS_CNT
+   times, one sector at a time, checking its contents on every
+   pass. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/filesys/extended/bench-read.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-bench-read";
+
+static char buf1[BUF_SIZE];
+static char buf2[CHUNK_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  char file_name[16];
+  int child_idx;
+  int file_idx;
+  int fd;
+  int pass;
+  int i;
+  size_t ofs;
+
+  quiet = true;
+  
+  CHECK (argc == 3, "argc must be 3, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  file_idx = atoi (argv[2]);
+  snprintf (file_name, sizeof file_name, "data%d", file_idx);
+
+  /* File N is the (N + 1)th BUF_SIZE bytes of the stream. */
+  random_init (0);
+  for (i = 0; i <= file_idx; i++)
+    random_bytes (buf1, sizeof buf1);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (pass = 0; pass < PASS_CNT; pass++)
+    {
+      seek (fd, 0);
+      for (ofs = 0; ofs < sizeof buf1; ofs += CHUNK_SIZE)
+        {
+          CHECK (read (fd, buf2, CHUNK_SIZE) == CHUNK_SIZE,
+                 "read %d bytes at offset %zu in \"%s\"",
+                 CHUNK_SIZE, ofs, file_name);
+          compare_bytes (buf2, buf1 + ofs, CHUNK_SIZE, ofs, file_name);
+        }
+    }
+  close (fd);
+
+  return child_idx;
+}
@@ -0,0 +1,37 @@
+# -*- perl -*-
+# Checks the output of a crash test.  After each crash point, and
+# the crash of the recovery boot that follows it, fsck must have
+# found the file system consistent, and wherever the power was cut
+# at shutdown both times, the test's persistence check must have
+# passed.
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "crash test produced no output at all\n" if @output == 0;
+check_for_panic ("crash test", @output);
+check_for_triple_fault ("crash test", @output);
+check_for_keyword ("crash test", "TIMEOUT", @output);
+
+my ($points) = scalar (grep (/^crash point \d+:$/, @output));
+my ($runs) = scalar (grep (/^fsck: \d+ files, \d+ directories$/, @output));
+my ($good) = scalar (grep (/^fsck: file system is consistent$/, @output));
+fail "fsck ran after $runs of $points crashes\n" if $runs != $points;
+fail "fsck found problems after ", $runs - $good, " of $runs crashes:\n",
+  map ("$_\n", grep (/^fsck: /, @output))
+  if $good != $runs;
+
+my (@persistence) = grep (/^persistence: /, @output);
+fail "the power was never cut at shutdown, so nothing checked that "
+  . "the test's files survived\n"
+  if !@persistence;
+for my $i (0...$#output) {
+    next if $output[$i] !~ /^persistence: (\S+)$/ || $1 eq 'PASS';
+    my (@why) = ($output[$i]);
+    push (@why, $output[$i]) while ++$i <= $#output
+      && $output[$i] !~ /^(crash point|persistence:)/;
+    fail "files did not survive a power cut at shutdown:\n",
+      map ("$_\n", @why);
+}
+pass;
@@ -0,0 +1,20 @@
+/* Benchmark: execs child-bench many times, one after the other.
+   Compare the "Timer: N ticks" line printed at shutdown against
+   bench-fork-exec to see what a preceding fork costs. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ROUNDS 64
+
+void
+test_main (void)
+{
+  int i;
+
+  for (i = 0; i < ROUNDS; i++)
+    if (wait (exec ("child-bench")) != 0x42)
+      fail ("exec round %d", i);
+  msg ("%d rounds", ROUNDS);
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(bench-exec) begin
+(bench-exec) 64 rounds
+(bench-exec) end
+EOF
+pass;
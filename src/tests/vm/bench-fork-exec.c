@@ -0,0 +1,25 @@
+/* Benchmark: forks many times, each child execs child-bench and
+   passes on its exit code.  Compare the "Timer: N ticks" line
+   printed at shutdown against bench-exec. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ROUNDS 64
+
+void
+test_main (void)
+{
+  int i;
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      pid_t child = fork ();
+      if (child == 0)
+        exit (wait (exec ("child-bench")));
+      if (child == PID_ERROR || wait (child) != 0x42)
+        fail ("fork round %d", i);
+    }
+  msg ("%d rounds", ROUNDS);
+}
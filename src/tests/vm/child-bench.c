@@ -0,0 +1,8 @@
+/* Child process of bench-exec and bench-fork-exec.
+   Exits right away, so that only process creation is timed. */
+
+int
+main (void) 
+{
+  return 0x42;
+}
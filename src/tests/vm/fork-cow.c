@@ -0,0 +1,35 @@
+/* Forks a child that scribbles over a large array, and checks
+   that the parent's copy of the array is left untouched, and
+   that the child started out with the parent's data. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  memset (buf, 'p', SIZE);
+  child = fork ();
+  if (child == 0)
+    {
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != 'p')
+          exit (1);
+      memset (buf, 'c', SIZE);
+      exit (2);
+    }
+  CHECK (child != PID_ERROR, "fork");
+  CHECK (wait (child) == 2, "wait for child");
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 'p')
+      fail ("byte %zu changed to '%c' by child", i, buf[i]);
+}
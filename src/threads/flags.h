@@ -5,4 +5,12 @@
 #define FLAG_MBS  0x00000002    /* Must be set. */
 #define FLAG_IF   0x00000200    /* Interrupt Flag. */
 
+/* CR4 Register. */
+#define CR4_PSE   0x00000010    /* Page Size Extensions (4 MB pages). */
+#define CR4_PGE   0x00000080    /* Page Global Enable. */
+
+/* CPUID leaf 1, EDX feature bits. */
+#define CPUID_EDX_PSE 0x00000008 /* Page Size Extensions supported. */
+#define CPUID_EDX_PGE 0x00002000 /* Global pages supported. */
+
 #endif /* threads/flags.h */
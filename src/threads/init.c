@@ -15,17 +15,22 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memtrack.h"
 #include "threads/palloc.h"
+#include "threads/pressure.h"
 #include "threads/pte.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
+#include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
@@ -34,11 +39,16 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
 #ifdef VM
 #include "vm/frame.h"
+#include "vm/sup_page.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -60,8 +70,32 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -o palloc-bench: benchmark the page allocator at boot. */
+static bool palloc_bench_at_boot;
+
+/* -o no-pse: map all of physical memory with 4 kB pages. */
+static bool pse_disabled;
+
+/* -o tlb-bench: time a strided walk over the kernel's mapping of
+   physical memory at boot. */
+static bool tlb_bench_at_boot;
+
+/* -o no-pge: do not mark kernel mappings global. */
+static bool pge_disabled;
+
+/* -o switch-bench: time thread ping-pong at boot. */
+static bool switch_bench_at_boot;
+
+/* Whether paging_init mapped memory with 4 MB pages, and whether
+   it marked the kernel mappings global. */
+static bool pse_enabled;
+static bool pge_enabled;
+
 static void bss_init (void);
 static void paging_init (void);
+static uint32_t cpu_features (void);
+static void tlb_bench (void);
+static void switch_bench (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -99,7 +133,9 @@ main (void)
 
   /* Initialize memory system. */
   palloc_init (user_page_limit);
+  memtrack_init ();
   malloc_init ();
+  synch_init ();
   paging_init ();
   /* Segmentation. */
 #ifdef USERPROG
@@ -119,8 +155,15 @@ main (void)
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  pressure_init ();
   serial_init_queue ();
   timer_calibrate ();
+  if (palloc_bench_at_boot)
+    palloc_bench ();
+  if (tlb_bench_at_boot)
+    tlb_bench ();
+  if (switch_bench_at_boot)
+    switch_bench ();
 
 #ifdef FILESYS
   /* Initialize file system. */
@@ -130,6 +173,8 @@ main (void)
 #endif
 #ifdef VM
   frame_table_init ();
+  sup_page_init ();
+  swap_init ();
 #endif
 
   printf ("Boot complete.\n");
@@ -157,13 +202,31 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports page size extensions, every fully present
+   4 MB region of physical memory is mapped by a single large
+   PDE, which saves its page table and lets one TLB entry cover
+   the whole region.  The region holding the kernel text keeps
+   4 kB pages so that the text can stay read-only.
+
+   If the CPU supports global pages, all of these mappings are
+   marked global.  They are the same in every page directory, so
+   they can stay in the TLB when CR3 changes on a process
+   switch. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  const size_t large_pages = LARGE_PGSIZE / PGSIZE;
+  uint32_t features = cpu_features ();
+  uint32_t global, cr4;
+
+  pse_enabled = !pse_disabled && (features & CPUID_EDX_PSE) != 0;
+  pge_enabled = !pge_disabled && (features & CPUID_EDX_PGE) != 0;
+  global = pge_enabled ? PTE_G : 0;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -175,13 +238,33 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse_enabled && page % large_pages == 0
+          && page + large_pages <= init_ram_pages
+          && (vaddr >= &_end_kernel_text
+              || vaddr + LARGE_PGSIZE <= &_start))
+        {
+          pd[pde_idx] = pde_create_large (vaddr) | global;
+          page += large_pages - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
+    }
+
+  /* Large PDEs are only honored once CR4.PSE is set, so set it
+     before switching to the new page directory.  See [IA32-v3a]
+     2.5 "Control Registers". */
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (pse_enabled)
+    {
+      cr4 |= CR4_PSE;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
     }
 
   /* Store the physical address of the page directory into CR3
@@ -190,6 +273,177 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* Enable global pages only now, so that no stale global entry
+     from the boot page tables lingers in the TLB. */
+  if (pge_enabled)
+    {
+      cr4 |= CR4_PGE;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
+}
+
+/* Returns the CPUID leaf 1 feature bits in EDX. */
+static uint32_t
+cpu_features (void)
+{
+  uint32_t eax = 1, ebx, ecx = 0, edx;
+
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+  return edx;
+}
+
+/* Touches one byte in every page of the first 16 MB of physical
+   memory (or all of it, if there is less), through the kernel
+   mapping, over and over, and reports how long that took.  With
+   4 kB pages nearly every access misses the TLB; with 4 MB pages
+   a handful of entries covers the whole walk.  Compare a run
+   with `-o no-pse'. */
+static void
+tlb_bench (void)
+{
+  enum { PASSES = 256 };
+  size_t pages = 16 * 1024 * 1024 / PGSIZE;
+  volatile uint8_t *base = ptov (0);
+  uint32_t sum = 0;
+  int64_t start, ticks;
+  size_t page;
+  int pass;
+
+  if (pages > init_ram_pages)
+    pages = init_ram_pages;
+
+  start = timer_ticks ();
+  for (pass = 0; pass < PASSES; pass++)
+    for (page = 0; page < pages; page++)
+      sum += base[page * PGSIZE + (pass % (PGSIZE / 64)) * 64];
+  ticks = timer_elapsed (start);
+
+  printf ("tlb-bench: %zu pages x %d passes with %s pages: "
+          "%"PRId64" ticks (checksum %"PRIu32")\n",
+          pages, PASSES, pse_enabled ? "4 MB" : "4 kB", ticks, sum);
+}
+
+/* Semaphores the two threads of switch_bench hand control back
+   and forth with, the number of round trips to make, and the
+   kernel pages each thread reads before handing control over. */
+#define SWITCH_ROUNDS 10000
+#define SWITCH_PAGES 16
+static struct semaphore ping, pong, switch_done;
+static volatile uint8_t *switch_buf;
+static int64_t switch_ticks;
+
+/* Gives the running thread a page directory of its own, as a
+   user process has, so that every switch to it loads CR3. */
+static void
+switch_bench_enter (void)
+{
+#ifdef USERPROG
+  struct thread *t = thread_current ();
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    PANIC ("switch-bench: out of memory");
+  process_activate ();
+#endif
+}
+
+/* Undoes switch_bench_enter(), in the order process_exit()
+   uses. */
+static void
+switch_bench_leave (void)
+{
+#ifdef USERPROG
+  struct thread *t = thread_current ();
+  uint32_t *pd = t->pagedir;
+
+  t->pagedir = NULL;
+  pagedir_activate (NULL);
+  pagedir_destroy (pd);
+#endif
+}
+
+/* Reads one byte from each page of switch_buf.  These kernel
+   mappings survive a CR3 load in the TLB only if they are
+   global. */
+static void
+switch_bench_touch (void)
+{
+  size_t page;
+
+  for (page = 0; page < SWITCH_PAGES; page++)
+    switch_buf[page * PGSIZE];
+}
+
+/* The first thread of switch_bench: pings and times the round
+   trips. */
+static void
+switch_bench_ping (void *aux UNUSED)
+{
+  int64_t start;
+  int i;
+
+  switch_bench_enter ();
+  start = timer_ticks ();
+  for (i = 0; i < SWITCH_ROUNDS; i++)
+    {
+      switch_bench_touch ();
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  switch_ticks = timer_elapsed (start);
+  switch_bench_leave ();
+  sema_up (&switch_done);
+}
+
+/* The second thread of switch_bench: answers each ping. */
+static void
+switch_bench_pong (void *aux UNUSED)
+{
+  int i;
+
+  switch_bench_enter ();
+  for (i = 0; i < SWITCH_ROUNDS; i++)
+    {
+      sema_down (&ping);
+      switch_bench_touch ();
+      sema_up (&pong);
+    }
+  switch_bench_leave ();
+  sema_up (&switch_done);
+}
+
+/* Bounces control between two threads SWITCH_ROUNDS times and
+   reports how long that took.  Every round trip is two context
+   switches.  With user programs, each thread has a page
+   directory of its own, like a process, so every switch loads
+   CR3; compare a run with `-o no-pge', which loses the kernel's
+   TLB entries on each load, and with `-o no-lazy-cr3'. */
+static void
+switch_bench (void)
+{
+  int priority = thread_get_priority ();
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  sema_init (&switch_done, 0);
+  switch_buf = palloc_get_multiple (PAL_ASSERT, SWITCH_PAGES);
+  thread_create ("ping", priority, switch_bench_ping, NULL);
+  thread_create ("pong", priority, switch_bench_pong, NULL);
+  sema_down (&switch_done);
+  sema_down (&switch_done);
+  palloc_free_multiple ((void *) switch_buf, SWITCH_PAGES);
+
+#ifdef USERPROG
+  printf ("switch-bench: %d round trips between page directories "
+          "with%s global pages%s: %"PRId64" ticks\n",
+          SWITCH_ROUNDS, pge_enabled ? "" : "out",
+          pagedir_lazy_cr3 ? "" : ", no lazy CR3", switch_ticks);
+#else
+  printf ("switch-bench: %d round trips with%s global pages: "
+          "%"PRId64" ticks\n",
+          SWITCH_ROUNDS, pge_enabled ? "" : "out", switch_ticks);
+#endif
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -251,15 +505,55 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        cache_size = atoi (value);
+      else if (!strcmp (name, "-ra"))
+        cache_readahead_max = atoi (value);
+      else if (!strcmp (name, "-dcache"))
+        dcache_size = atoi (value);
+      else if (!strcmp (name, "-crash"))
+        filesys_crash_after = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
 #endif
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-rss"))
+        frame_rss_max = atoi (value);
+      else if (!strcmp (name, "-vmstats"))
+        frame_ws_stats = true;
+      else if (!strcmp (name, "-zswap"))
+        zswap_max_pages = atoi (value);
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-o"))
+        {
+          /* "-o NAME" or "-o=NAME" */
+          if (value == NULL && (value = *++argv) == NULL)
+            PANIC ("option `-o' requires an argument (use -h for help)");
+          if (!strcmp (value, "palloc-bench"))
+            palloc_bench_at_boot = true;
+          else if (!strcmp (value, "memtrack"))
+            memtrack_enabled = true;
+          else if (!strcmp (value, "no-pse"))
+            pse_disabled = true;
+          else if (!strcmp (value, "tlb-bench"))
+            tlb_bench_at_boot = true;
+          else if (!strcmp (value, "no-pge"))
+            pge_disabled = true;
+          else if (!strcmp (value, "switch-bench"))
+            switch_bench_at_boot = true;
+#ifdef USERPROG
+          else if (!strcmp (value, "no-lazy-cr3"))
+            pagedir_lazy_cr3 = false;
+#endif
+          else
+            PANIC ("unknown option `-o %s' (use -h for help)", value);
+        }
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -319,6 +613,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"fsck", 1, fsutil_fsck},
 #endif
       {NULL, 0, NULL},
     };
@@ -365,6 +660,7 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  fsck               Check the file system for consistency.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -377,14 +673,31 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=COUNT       Cache COUNT file system sectors (default 64).\n"
+          "  -ra=COUNT          Read at most COUNT sectors ahead, 0 for none.\n"
+          "  -dcache=COUNT      Cache COUNT looked-up names (default 128).\n"
+          "  -crash=COUNT       Cut the power after COUNT file system writes,\n"
+          "                     or at shutdown if there are fewer.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -o palloc-bench    Benchmark the page allocator during startup.\n"
+          "  -o memtrack        Track allocations, report leaks per call site.\n"
+          "  -o no-pse          Map physical memory with 4 kB pages only.\n"
+          "  -o tlb-bench       Time a strided walk over physical memory.\n"
+          "  -o no-pge          Do not keep kernel mappings in the TLB globally.\n"
+          "  -o switch-bench    Time context switches between two threads.\n"
 #ifdef USERPROG
+          "  -o no-lazy-cr3     Load CR3 on every switch, even if unchanged.\n"
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -rss=COUNT         Limit each process to COUNT resident pages.\n"
+          "  -vmstats           Print resident set and faults at process exit.\n"
+          "  -zswap=COUNT       Keep up to COUNT pages of compressed swap in RAM.\n"
 #endif
           );
   shutdown_power_off ();
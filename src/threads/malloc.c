@@ -5,8 +5,11 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memtrack.h"
 #include "threads/palloc.h"
+#include "threads/pressure.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -28,6 +31,21 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
+   Each thread keeps a few free blocks of every size in its own
+   cache, its "tcache", and malloc() and free() use those without
+   taking the descriptor lock; no other thread touches them.  An
+   empty tcache chain is refilled with TCACHE_BATCH blocks, and a
+   chain that grows past TCACHE_MAX gives TCACHE_BATCH blocks back,
+   each under one lock acquisition.  Blocks in a tcache count as in
+   use for their arena.
+
+   Giving an arena back means taking all of its blocks off the free
+   list, so it is done lazily: each descriptor keeps up to
+   ARENA_KEEP entirely unused arenas, and only an arena that becomes
+   unused beyond those is freed.  A single malloc()/free() pair
+   thus does not create and destroy an arena every time.  Under
+   memory pressure, the shrinker frees the kept arenas too.
+
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
@@ -40,9 +58,17 @@ struct desc
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
+    size_t empty_cnt;           /* Arenas with no block in use. */
     struct lock lock;           /* Lock. */
   };
 
+/* Per-thread cache limits, in blocks per size class. */
+#define TCACHE_MAX 8
+#define TCACHE_BATCH 4
+
+/* Unused arenas kept per descriptor. */
+#define ARENA_KEEP 2
+
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
@@ -66,6 +92,14 @@ static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *desc_get (struct desc *);
+static void desc_put (struct desc *, struct block *);
+static void tcache_drain (struct desc *, size_t cnt);
+static void *do_malloc (size_t size, void *caller);
+static size_t malloc_shrink (size_t nr);
+
+static struct shrinker malloc_shrinker =
+  { .name = "malloc", .shrink = malloc_shrink };
 
 /* Initializes the malloc() descriptors. */
 void
@@ -80,18 +114,38 @@ malloc_init (void)
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
+      d->empty_cnt = 0;
       lock_init (&d->lock);
     }
+  ASSERT (desc_cnt <= MALLOC_CLASSES);
+  shrinker_register (&malloc_shrinker);
+}
+
+/* Returns the tcache chains of the running thread. */
+static struct malloc_tcache *
+tcache (void)
+{
+  return &thread_current ()->tcache;
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  return do_malloc (size, __builtin_return_address (0));
+}
+
+/* Does the work of malloc(), on behalf of the function that
+   returns to CALLER. */
+static void *
+do_malloc (size_t size, void *caller)
 {
   struct desc *d;
   struct block *b;
   struct arena *a;
+  struct malloc_tcache *tc;
+  size_t i;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -116,10 +170,45 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+      memtrack_alloc (MEM_MALLOC, a + 1, PGSIZE * page_cnt, caller);
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
+  /* Fast path: a block cached for this thread. */
+  tc = tcache ();
+  i = d - descs;
+  if (tc->cnt[i] == 0)
+    {
+      /* Refill the chain from the free list. */
+      lock_acquire (&d->lock);
+      while (tc->cnt[i] < TCACHE_BATCH)
+        {
+          b = desc_get (d);
+          if (b == NULL)
+            break;
+          *(void **) b = tc->blocks[i];
+          tc->blocks[i] = b;
+          tc->cnt[i]++;
+        }
+      lock_release (&d->lock);
+      if (tc->cnt[i] == 0)
+        return NULL;
+    }
+  b = tc->blocks[i];
+  tc->blocks[i] = *(void **) b;
+  tc->cnt[i]--;
+  memtrack_alloc (MEM_MALLOC, b, d->block_size, caller);
+  return b;
+}
+
+/* Takes a block off D's free list, creating a new arena if the
+   list is empty, and returns it.  Returns a null pointer if
+   memory is not available.  D's lock must be held. */
+static struct block *
+desc_get (struct desc *d)
+{
+  struct block *b;
+  struct arena *a;
 
   /* If the free list is empty, create a new arena. */
   if (list_empty (&d->free_list))
@@ -129,15 +218,13 @@ malloc (size_t size)
       /* Allocate a page. */
       a = palloc_get_page (0);
       if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
+        return NULL; 
 
       /* Initialize arena and add its blocks to the free list. */
       a->magic = ARENA_MAGIC;
       a->desc = d;
       a->free_cnt = d->blocks_per_arena;
+      d->empty_cnt++;
       for (i = 0; i < d->blocks_per_arena; i++) 
         {
           struct block *b = arena_to_block (a, i);
@@ -148,8 +235,8 @@ malloc (size_t size)
   /* Get a block from free list and return it. */
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
+  if (a->free_cnt-- == d->blocks_per_arena)
+    d->empty_cnt--;
   return b;
 }
 
@@ -167,7 +254,7 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = do_malloc (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
@@ -201,7 +288,8 @@ realloc (void *old_block, size_t new_size)
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = do_malloc (new_size,
+                                   __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -224,6 +312,8 @@ free (void *p)
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
       
+      memtrack_free (MEM_MALLOC, p,
+                     d != NULL ? d->block_size : PGSIZE * a->free_cnt);
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
@@ -233,26 +323,14 @@ free (void *p)
           memset (b, 0xcc, d->block_size);
 #endif
   
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
-
-          lock_release (&d->lock);
+          /* Cache it for this thread, and give some back to the
+             free list if the cache is full. */
+          struct malloc_tcache *tc = tcache ();
+          size_t i = d - descs;
+          *(void **) b = tc->blocks[i];
+          tc->blocks[i] = b;
+          if (++tc->cnt[i] > TCACHE_MAX)
+            tcache_drain (d, TCACHE_BATCH);
         }
       else
         {
@@ -263,6 +341,109 @@ free (void *p)
     }
 }
 
+/* Puts block B, whose arena counts it as in use, back on D's free
+   list.  If that leaves more than ARENA_KEEP arenas of D unused,
+   B's arena is given back to the page allocator.  D's lock must be
+   held. */
+static void
+desc_put (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, maybe free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      if (++d->empty_cnt <= ARENA_KEEP)
+        return;
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      d->empty_cnt--;
+      palloc_free_page (a);
+    }
+}
+
+/* Shrinker: frees up to NR of the unused arenas that descriptors
+   keep. */
+static size_t
+malloc_shrink (size_t nr)
+{
+  size_t freed = 0;
+  size_t i;
+
+  for (i = 0; i < desc_cnt && freed < nr; i++)
+    {
+      struct desc *d = &descs[i];
+      struct list_elem *e;
+
+      lock_acquire (&d->lock);
+      e = list_begin (&d->free_list);
+      while (d->empty_cnt > 0 && freed < nr && e != list_end (&d->free_list))
+        {
+          struct arena *a = block_to_arena (list_entry (e, struct block,
+                                                        free_elem));
+          size_t j;
+
+          e = list_next (e);
+          if (a->free_cnt != d->blocks_per_arena)
+            continue;
+
+          /* All of A's blocks are free, so all are on the list. */
+          for (j = 0; j < d->blocks_per_arena; j++)
+            {
+              struct block *b = arena_to_block (a, j);
+              if (&b->free_elem == e)
+                e = list_next (e);
+              list_remove (&b->free_elem);
+            }
+          d->empty_cnt--;
+          palloc_free_page (a);
+          freed++;
+        }
+      lock_release (&d->lock);
+    }
+  return freed;
+}
+
+/* Gives CNT blocks of the running thread's chain for D back to D's
+   free list. */
+static void
+tcache_drain (struct desc *d, size_t cnt)
+{
+  struct malloc_tcache *tc = tcache ();
+  size_t i = d - descs;
+
+  lock_acquire (&d->lock);
+  while (cnt-- > 0 && tc->cnt[i] > 0)
+    {
+      struct block *b = tc->blocks[i];
+      tc->blocks[i] = *(void **) b;
+      tc->cnt[i]--;
+      desc_put (d, b);
+    }
+  lock_release (&d->lock);
+}
+
+/* Gives all blocks cached for the running thread back.  Called
+   as the thread exits. */
+void
+malloc_thread_exit (void)
+{
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    if (tcache ()->cnt[i] > 0)
+      tcache_drain (&descs[i], tcache ()->cnt[i]);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
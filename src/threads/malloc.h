@@ -4,7 +4,17 @@
 #include <debug.h>
 #include <stddef.h>
 
+/* Per-thread cache of free blocks, one chain per size class.
+   See malloc.c. */
+#define MALLOC_CLASSES 7
+struct malloc_tcache
+  {
+    void *blocks[MALLOC_CLASSES];       /* Chains of free blocks. */
+    unsigned char cnt[MALLOC_CLASSES];  /* Blocks in each chain. */
+  };
+
 void malloc_init (void);
+void malloc_thread_exit (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
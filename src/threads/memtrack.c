@@ -0,0 +1,208 @@
+#include "threads/memtrack.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Kernel memory accounting.
+
+   Bytes in use are always counted for each kind of memory: pages
+   of each pool and malloc() blocks.  That costs an addition per
+   call, cheap enough to leave on.
+
+   With kernel option -o memtrack, every allocation is also
+   recorded with its size, the thread that made it and its call
+   site, the return address into the caller.  Outstanding
+   allocations are reported per call site when a process exits
+   and at shutdown; feed the addresses to the `backtrace' tool to
+   get source lines.  Records live in an open-addressed hash table
+   of MEMTRACK_PAGES pages, taken from the kernel pool at boot;
+   allocations that do not fit are only counted.
+
+   There is only one CPU, so interrupts are turned off instead of
+   taking a lock, which would allocate in lock_acquire(). */
+
+/* Size of the record table. */
+#define MEMTRACK_PAGES 16
+
+/* Call sites gathered for one report. */
+#define MEMTRACK_SITES 32
+
+/* An allocation. */
+struct mem_record
+  {
+    void *ptr;                  /* Address, null if slot empty. */
+    void *caller;               /* Call site. */
+    size_t size;                /* Bytes. */
+    tid_t tid;                  /* Allocating thread. */
+  };
+
+/* Marks a record slot freed, for probing past it. */
+#define DELETED ((void *) 1)
+
+bool memtrack_enabled;
+
+static long long bytes_in_use[MEM_KIND_CNT];
+static const char *kind_names[MEM_KIND_CNT] =
+  { "kernel pool", "user pool", "malloc" };
+
+static struct mem_record *records;  /* Record table. */
+static size_t record_cnt;           /* Slots in table. */
+static long long dropped_cnt;       /* Allocations not recorded. */
+
+/* Allocates the record table, if tracking is enabled.  Must be
+   called right after palloc_init(). */
+void
+memtrack_init (void)
+{
+  if (!memtrack_enabled)
+    return;
+  records = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, MEMTRACK_PAGES);
+  record_cnt = MEMTRACK_PAGES * PGSIZE / sizeof *records;
+}
+
+/* Returns the first slot to probe for PTR. */
+static size_t
+record_hash (const void *ptr)
+{
+  return ((uintptr_t) ptr >> 4) * 2654435761u % record_cnt;
+}
+
+/* Counts SIZE bytes of KIND allocated at PTR, and records the
+   allocation with CALLER if tracking is enabled. */
+void
+memtrack_alloc (enum mem_kind kind, void *ptr, size_t size, void *caller)
+{
+  enum intr_level old_level = intr_disable ();
+  bytes_in_use[kind] += size;
+  if (records != NULL)
+    {
+      size_t i, n;
+      for (i = record_hash (ptr), n = 0; n < record_cnt;
+           i = (i + 1) % record_cnt, n++)
+        if (records[i].ptr == NULL || records[i].ptr == DELETED)
+          {
+            records[i].ptr = ptr;
+            records[i].caller = caller;
+            records[i].size = size;
+            records[i].tid = thread_current ()->tid;
+            break;
+          }
+      if (n == record_cnt)
+        dropped_cnt++;
+    }
+  intr_set_level (old_level);
+}
+
+/* Counts SIZE bytes of KIND at PTR freed and forgets their
+   record. */
+void
+memtrack_free (enum mem_kind kind, void *ptr, size_t size)
+{
+  enum intr_level old_level = intr_disable ();
+  bytes_in_use[kind] -= size;
+  if (records != NULL)
+    {
+      size_t i, n;
+      for (i = record_hash (ptr), n = 0;
+           n < record_cnt && records[i].ptr != NULL;
+           i = (i + 1) % record_cnt, n++)
+        if (records[i].ptr == ptr)
+          {
+            records[i].ptr = DELETED;
+            break;
+          }
+    }
+  intr_set_level (old_level);
+}
+
+/* A call site in a report. */
+struct mem_site
+  {
+    void *caller;
+    size_t bytes;
+    size_t cnt;
+  };
+
+/* Prints the outstanding allocations made by thread TID, or by
+   any thread if TID is TID_ERROR, summed per call site.  Only
+   the first MEMTRACK_SITES sites found are listed; allocations
+   from any others are counted together.  The table is on the
+   stack, so that threads exiting at the same time each print
+   their own. */
+static void
+report (tid_t tid)
+{
+  struct mem_site sites[MEMTRACK_SITES];
+  size_t site_cnt = 0, bytes = 0, cnt = 0, other = 0;
+  size_t i, j;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  for (i = 0; i < record_cnt; i++)
+    {
+      struct mem_record *r = &records[i];
+      if (r->ptr == NULL || r->ptr == DELETED
+          || (tid != TID_ERROR && r->tid != tid))
+        continue;
+      bytes += r->size;
+      cnt++;
+      for (j = 0; j < site_cnt; j++)
+        if (sites[j].caller == r->caller)
+          break;
+      if (j == site_cnt)
+        {
+          if (site_cnt == MEMTRACK_SITES)
+            {
+              other++;
+              continue;
+            }
+          sites[site_cnt].caller = r->caller;
+          sites[site_cnt].bytes = sites[site_cnt].cnt = 0;
+          site_cnt++;
+        }
+      sites[j].bytes += r->size;
+      sites[j].cnt++;
+    }
+  intr_set_level (old_level);
+
+  printf ("memtrack: %zu bytes outstanding in %zu allocations\n",
+          bytes, cnt);
+  for (j = 0; j < site_cnt; j++)
+    printf ("memtrack:   %p: %zu bytes in %zu allocations\n",
+            sites[j].caller, sites[j].bytes, sites[j].cnt);
+  if (other > 0)
+    printf ("memtrack:   %zu allocations from other sites\n", other);
+}
+
+/* Reports the outstanding allocations of exiting thread TID. */
+void
+memtrack_report_thread (tid_t tid)
+{
+  if (records == NULL)
+    return;
+  printf ("memtrack: thread %d exits\n", tid);
+  report (tid);
+}
+
+/* Prints memory accounting statistics. */
+void
+memtrack_print_stats (void)
+{
+  int k;
+
+  printf ("Memory:");
+  for (k = 0; k < MEM_KIND_CNT; k++)
+    printf ("%s %lld bytes %s", k ? "," : "", bytes_in_use[k],
+            kind_names[k]);
+  printf (" in use\n");
+  if (records != NULL)
+    {
+      report (TID_ERROR);
+      if (dropped_cnt > 0)
+        printf ("memtrack: %lld allocations not recorded\n", dropped_cnt);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef THREADS_MEMTRACK_H
+#define THREADS_MEMTRACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/thread.h"
+
+/* Kinds of memory counted.  See memtrack.c. */
+enum mem_kind
+  {
+    MEM_KERNEL_PAGES,           /* Pages from the kernel pool. */
+    MEM_USER_PAGES,             /* Pages from the user pool. */
+    MEM_MALLOC,                 /* Blocks from malloc(). */
+    MEM_KIND_CNT
+  };
+
+/* Record every allocation?  Kernel option -o memtrack. */
+extern bool memtrack_enabled;
+
+void memtrack_init (void);
+void memtrack_alloc (enum mem_kind, void *, size_t size, void *caller);
+void memtrack_free (enum mem_kind, void *, size_t size);
+void memtrack_report_thread (tid_t);
+void memtrack_print_stats (void);
+
+#endif /* threads/memtrack.h */
@@ -2,12 +2,18 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
+#include <random.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/memtrack.h"
+#include "threads/pressure.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -23,14 +29,80 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Free memory is kept as
+   blocks of 2**ORDER pages, aligned to their size relative to the
+   pool base, on one free list per order.  A request is rounded up
+   to a power of two, taken from the smallest order that has a
+   block, splitting larger blocks on the way down, and the pages
+   beyond the requested count are given back right away.  Freed
+   blocks merge with their buddy as long as it is free as well.
+   Both take O(log n) steps instead of a linear bitmap scan.  The
+   list element of a free block lives in its first page.
+
+   In front of the buddy lists, each pool has a magazine of free
+   single pages, used with interrupts off instead of the pool lock
+   since there is only one CPU.  An empty magazine is refilled
+   MAG_BATCH pages at a time under the pool lock, so most
+   single-page requests never touch the lock.  The used_map counts
+   magazine pages as free.
+
+   Freeing never takes the pool lock, because pages are freed with
+   interrupts off, e.g. by the scheduler when a thread dies.  Blocks
+   of more than one page, and single pages that find the magazine
+   full (MAG_HIGH pages), go on the pool's deferred list instead of
+   the free lists.  The next allocation that takes the lock merges
+   them in, draining the magazine down to MAG_HIGH - MAG_BATCH pages
+   first if it is full.  The used_map counts deferred pages as free
+   too.
+
+   Each pool also counts its free pages against three watermarks,
+   1/64, 2/64 and 3/64 of its size.  An allocation that leaves the
+   pool below the low one wakes the reclaimer (see pressure.c),
+   which frees pages until the pool is back at the high one. */
+
+/* Largest block, 2**PALLOC_MAX_ORDER pages. */
+#define PALLOC_MAX_ORDER 10
+
+/* Magazine size and refill/drain batch, in pages. */
+#define MAG_HIGH 32
+#define MAG_BATCH 16
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *order_map;                 /* Per page: 1 + order if the
+                                           page heads a free block,
+                                           0 otherwise. */
+    struct list free_lists[PALLOC_MAX_ORDER + 1]; /* Free blocks. */
+    size_t page_cnt;                    /* Number of pages. */
     uint8_t *base;                      /* Base of pool. */
+
+    /* Free page count, protected by turning interrupts off. */
+    size_t free_cnt;                    /* Free pages, incl. mag. */
+    size_t min_wm, low_wm, high_wm;     /* Watermarks. */
+
+    /* Magazine, protected by turning interrupts off. */
+    void *mag[MAG_HIGH];                /* Free single pages. */
+    size_t mag_cnt;                     /* Number of pages in mag. */
+    long long mag_hits;                 /* Calls served by mag. */
+    long long mag_refills;              /* Batches moved from... */
+    long long mag_drains;               /* ...and to the free lists. */
+
+    /* Freed blocks not yet on the free lists, protected by turning
+       interrupts off. */
+    struct list deferred;               /* Of struct deferred_block. */
+  };
+
+/* A freed block on a pool's deferred list, kept in its first
+   page. */
+struct deferred_block
+  {
+    struct list_elem elem;              /* In pool's deferred list. */
+    size_t page_cnt;                    /* Pages in the block. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +111,15 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void *mag_get (struct pool *);
+static void mag_put (struct pool *, void *page);
+static void mag_drain (struct pool *, size_t keep);
+static void defer_free (struct pool *, void *pages, size_t page_cnt);
+static void merge_deferred (struct pool *);
+static void *get_pages (enum palloc_flags, size_t page_cnt, void *caller);
+static void count_free (struct pool *, size_t page_cnt, bool freed);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -65,10 +146,19 @@ palloc_init (size_t user_page_limit)
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   available, or PAGE_CNT is more than 2**PALLOC_MAX_ORDER,
+   returns a null pointer, unless PAL_ASSERT is set in FLAGS, in
+   which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
+{
+  return get_pages (flags, page_cnt, __builtin_return_address (0));
+}
+
+/* Does the work of palloc_get_multiple(), on behalf of the
+   function that returns to CALLER. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt, void *caller)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
@@ -77,19 +167,44 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+  if (page_cnt == 1)
+    {
+      pages = mag_get (pool);
+      if (pages != NULL)
+        {
+          page_idx = pg_no (pages) - pg_no (pool->base);
+          ASSERT (!bitmap_test (pool->used_map, page_idx));
+          bitmap_mark (pool->used_map, page_idx);
+        }
+    }
   else
-    pages = NULL;
+    {
+      lock_acquire (&pool->lock);
+      merge_deferred (pool);
+      page_idx = buddy_alloc (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR && pool->mag_cnt > 0)
+        {
+          /* The magazine may be holding back what would merge. */
+          mag_drain (pool, 0);
+          page_idx = buddy_alloc (pool, page_cnt);
+        }
+      if (page_idx != BITMAP_ERROR)
+        bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+      lock_release (&pool->lock);
+
+      if (page_idx != BITMAP_ERROR)
+        pages = pool->base + PGSIZE * page_idx;
+      else
+        pages = NULL;
+    }
 
   if (pages != NULL) 
     {
+      count_free (pool, page_cnt, false);
       if (flags & PAL_ZERO)
         memset (pages, 0, PGSIZE * page_cnt);
+      memtrack_alloc (pool == &user_pool ? MEM_USER_PAGES : MEM_KERNEL_PAGES,
+                      pages, PGSIZE * page_cnt, caller);
     }
   else 
     {
@@ -110,7 +225,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 void *
 palloc_get_page (enum palloc_flags flags) 
 {
-  return palloc_get_multiple (flags, 1);
+  return get_pages (flags, 1, __builtin_return_address (0));
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
@@ -132,13 +247,25 @@ palloc_free_multiple (void *pages, size_t page_cnt)
     NOT_REACHED ();
 
   page_idx = pg_no (pages) - pg_no (pool->base);
+  memtrack_free (pool == &user_pool ? MEM_USER_PAGES : MEM_KERNEL_PAGES,
+                 pages, PGSIZE * page_cnt);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+  count_free (pool, page_cnt, true);
+
+  if (page_cnt == 1)
+    {
+      ASSERT (bitmap_test (pool->used_map, page_idx));
+      bitmap_reset (pool->used_map, page_idx);
+      mag_put (pool, pages);
+      return;
+    }
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  defer_free (pool, pages, page_cnt);
 }
 
 /* Frees the page at PAGE. */
@@ -153,10 +280,14 @@ palloc_free_page (void *page)
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and order_map at its base.
+     Calculate the space needed for them and subtract it from the
+     pool's size. */
+  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt) + page_cnt,
+                                  PGSIZE);
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  int order;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -165,8 +296,22 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->order_map = (uint8_t *) base + bm_size;
+  memset (p->order_map, 0, page_cnt);
+  for (order = 0; order <= PALLOC_MAX_ORDER; order++)
+    list_init (&p->free_lists[order]);
+  p->page_cnt = page_cnt;
   p->base = base + bm_pages * PGSIZE;
+  p->mag_cnt = 0;
+  list_init (&p->deferred);
+  p->free_cnt = page_cnt;
+  p->min_wm = page_cnt / 64 + 1;
+  p->low_wm = 2 * p->min_wm;
+  p->high_wm = 3 * p->min_wm;
+
+  /* Everything is free. */
+  buddy_free (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +321,340 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Adds PAGE_CNT pages to POOL's free count if FREED, otherwise
+   takes them off, and wakes the reclaimer if that leaves POOL
+   below its low watermark. */
+static void
+count_free (struct pool *pool, size_t page_cnt, bool freed)
+{
+  enum intr_level old_level;
+  bool low;
+
+  old_level = intr_disable ();
+  if (freed)
+    pool->free_cnt += page_cnt;
+  else
+    pool->free_cnt -= page_cnt;
+  low = pool->free_cnt < pool->low_wm;
+  intr_set_level (old_level);
+  if (low && !freed)
+    pressure_wake ();
+}
+
+/* Returns how short of free pages the pool selected by FLAGS is.
+   Allocations that only speed things up should not be made at
+   PRESSURE_MIN. */
+enum palloc_pressure
+palloc_pressure (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  size_t free_cnt = pool->free_cnt;
+
+  if (free_cnt < pool->min_wm)
+    return PRESSURE_MIN;
+  else if (free_cnt < pool->low_wm)
+    return PRESSURE_LOW;
+  else
+    return PRESSURE_NONE;
+}
+
+/* Returns the number of pages the pool selected by FLAGS is short
+   of its high watermark. */
+size_t
+palloc_reclaim_target (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  size_t free_cnt = pool->free_cnt;
+
+  return free_cnt < pool->high_wm ? pool->high_wm - free_cnt : 0;
+}
+
+/* Returns the list element kept in the first page of the free
+   block at PAGE_IDX in POOL. */
+static struct list_elem *
+block_elem (const struct pool *pool, size_t page_idx)
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the index of the free block whose list element is E. */
+static size_t
+block_idx (const struct pool *pool, struct list_elem *e)
+{
+  return ((uint8_t *) e - pool->base) / PGSIZE;
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX on its free
+   list, merging it with its buddy for as long as possible. */
+static void
+block_insert (struct pool *pool, size_t page_idx, int order)
+{
+  while (order < PALLOC_MAX_ORDER)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+      if (buddy + ((size_t) 1 << order) > pool->page_cnt
+          || pool->order_map[buddy] != order + 1)
+        break;
+      list_remove (block_elem (pool, buddy));
+      pool->order_map[buddy] = 0;
+      if (buddy < page_idx)
+        page_idx = buddy;
+      order++;
+    }
+  pool->order_map[page_idx] = order + 1;
+  list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+}
+
+/* Frees PAGE_CNT pages at PAGE_IDX in POOL, as the largest
+   aligned blocks that make up the range. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t end = page_idx + page_cnt;
+  while (page_idx < end)
+    {
+      int order = 0;
+      while (order < PALLOC_MAX_ORDER
+             && page_idx % ((size_t) 1 << (order + 1)) == 0
+             && page_idx + ((size_t) 1 << (order + 1)) <= end)
+        order++;
+      block_insert (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+    }
+}
+
+/* Takes PAGE_CNT contiguous pages from POOL's free lists and
+   returns the index of the first, or BITMAP_ERROR.  POOL's lock
+   must be held. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  int want = 0, order;
+  size_t page_idx;
+
+  while (want <= PALLOC_MAX_ORDER && ((size_t) 1 << want) < page_cnt)
+    want++;
+  if (want > PALLOC_MAX_ORDER)
+    return BITMAP_ERROR;
+  for (order = want; order <= PALLOC_MAX_ORDER; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order > PALLOC_MAX_ORDER)
+    return BITMAP_ERROR;
+
+  page_idx = block_idx (pool, list_pop_front (&pool->free_lists[order]));
+  pool->order_map[page_idx] = 0;
+
+  /* Split down to the size wanted, keeping the lower halves. */
+  while (order > want)
+    {
+      order--;
+      size_t buddy = page_idx + ((size_t) 1 << order);
+      pool->order_map[buddy] = order + 1;
+      list_push_front (&pool->free_lists[order], block_elem (pool, buddy));
+    }
+
+  /* Give back what was rounded up. */
+  if (page_cnt < ((size_t) 1 << want))
+    buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+  return page_idx;
+}
+
+/* Returns a page from POOL's magazine, refilling the magazine from
+   the free lists first if it is empty.  Returns a null pointer if
+   the pool is out of pages. */
+static void *
+mag_get (struct pool *pool)
+{
+  enum intr_level old_level;
+  void *page = NULL;
+
+  old_level = intr_disable ();
+  if (pool->mag_cnt > 0)
+    {
+      page = pool->mag[--pool->mag_cnt];
+      pool->mag_hits++;
+    }
+  intr_set_level (old_level);
+  if (page != NULL)
+    return page;
+
+  lock_acquire (&pool->lock);
+  merge_deferred (pool);
+  old_level = intr_disable ();
+  while (pool->mag_cnt < MAG_BATCH)
+    {
+      size_t page_idx = buddy_alloc (pool, 1);
+      if (page_idx == BITMAP_ERROR)
+        break;
+      pool->mag[pool->mag_cnt++] = pool->base + PGSIZE * page_idx;
+    }
+  pool->mag_refills++;
+  if (pool->mag_cnt > 0)
+    page = pool->mag[--pool->mag_cnt];
+  intr_set_level (old_level);
+  lock_release (&pool->lock);
+  return page;
+}
+
+/* Puts PAGE in POOL's magazine, or on its deferred list if the
+   magazine is full.  Does not take POOL's lock. */
+static void
+mag_put (struct pool *pool, void *page)
+{
+  enum intr_level old_level;
+  bool done = false;
+
+  old_level = intr_disable ();
+  if (pool->mag_cnt < MAG_HIGH)
+    {
+      pool->mag[pool->mag_cnt++] = page;
+      done = true;
+    }
+  intr_set_level (old_level);
+  if (!done)
+    defer_free (pool, page, 1);
+}
+
+/* Gives all but KEEP pages of POOL's magazine back to the free
+   lists.  POOL's lock must be held. */
+static void
+mag_drain (struct pool *pool, size_t keep)
+{
+  void *pages[MAG_HIGH];
+  size_t cnt = 0, i;
+  enum intr_level old_level;
+
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+  old_level = intr_disable ();
+  while (pool->mag_cnt > keep)
+    pages[cnt++] = pool->mag[--pool->mag_cnt];
+  pool->mag_drains++;
+  intr_set_level (old_level);
+  for (i = 0; i < cnt; i++)
+    buddy_free (pool, pg_no (pages[i]) - pg_no (pool->base), 1);
+}
+
+/* Puts the PAGE_CNT free pages at PAGES on POOL's deferred list.
+   Does not take POOL's lock, so it may be called with interrupts
+   off. */
+static void
+defer_free (struct pool *pool, void *pages, size_t page_cnt)
+{
+  struct deferred_block *b = pages;
+  enum intr_level old_level;
+
+  b->page_cnt = page_cnt;
+  old_level = intr_disable ();
+  list_push_back (&pool->deferred, &b->elem);
+  intr_set_level (old_level);
+}
+
+/* Moves the blocks on POOL's deferred list to the free lists,
+   draining a full magazine as well so that its pages can merge.
+   POOL's lock must be held. */
+static void
+merge_deferred (struct pool *pool)
+{
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+  if (pool->mag_cnt == MAG_HIGH)
+    mag_drain (pool, MAG_HIGH - MAG_BATCH);
+  for (;;)
+    {
+      struct deferred_block *b = NULL;
+      enum intr_level old_level;
+
+      old_level = intr_disable ();
+      if (!list_empty (&pool->deferred))
+        b = list_entry (list_pop_front (&pool->deferred),
+                        struct deferred_block, elem);
+      intr_set_level (old_level);
+      if (b == NULL)
+        break;
+      buddy_free (pool, pg_no (b) - pg_no (pool->base), b->page_cnt);
+    }
+}
+
+/* Gathers the free space of POOL: free pages, free blocks, and
+   pages in the largest free block. */
+static void
+pool_free_stats (struct pool *pool, size_t *free_pages, size_t *blocks,
+                 size_t *largest)
+{
+  int order;
+
+  *free_pages = *blocks = *largest = 0;
+  lock_acquire (&pool->lock);
+  merge_deferred (pool);
+  for (order = 0; order <= PALLOC_MAX_ORDER; order++)
+    {
+      size_t n = list_size (&pool->free_lists[order]);
+      *free_pages += n << order;
+      *blocks += n;
+      if (n > 0)
+        *largest = (size_t) 1 << order;
+    }
+  lock_release (&pool->lock);
+}
+
+/* Allocator benchmark, kernel option -o palloc-bench.  Runs
+   random allocations of mostly single pages, some up to 32 pages,
+   and frees in the kernel pool, then reports the time taken and
+   how fragmented the free space is left.  All memory taken is
+   given back at the end. */
+#define BENCH_SLOTS 256
+#define BENCH_OPS 20000
+
+void
+palloc_bench (void)
+{
+  static struct
+    {
+      void *pages;
+      size_t page_cnt;
+    }
+  slots[BENCH_SLOTS];
+  size_t free_pages, blocks, largest;
+  size_t failed = 0;
+  int64_t start, elapsed;
+  int i;
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_OPS; i++)
+    {
+      size_t s = random_ulong () % BENCH_SLOTS;
+      if (slots[s].pages != NULL)
+        {
+          palloc_free_multiple (slots[s].pages, slots[s].page_cnt);
+          slots[s].pages = NULL;
+          continue;
+        }
+      slots[s].page_cnt = random_ulong () % 4 ? 1 : 2 + random_ulong () % 31;
+      slots[s].pages = palloc_get_multiple (0, slots[s].page_cnt);
+      if (slots[s].pages == NULL)
+        failed++;
+    }
+  elapsed = timer_elapsed (start);
+
+  pool_free_stats (&kernel_pool, &free_pages, &blocks, &largest);
+  printf ("palloc-bench: %d operations in %"PRId64" ticks, "
+          "%zu allocations failed\n", BENCH_OPS, elapsed, failed);
+  printf ("palloc-bench: %zu pages free in %zu blocks, largest %zu pages "
+          "(%zu%% fragmented)\n", free_pages, blocks, largest,
+          free_pages ? 100 - largest * 100 / free_pages : 0);
+  printf ("palloc-bench: %lld single pages from the magazine, "
+          "%lld refills, %lld drains\n", kernel_pool.mag_hits,
+          kernel_pool.mag_refills, kernel_pool.mag_drains);
+
+  for (i = 0; i < BENCH_SLOTS; i++)
+    if (slots[i].pages != NULL)
+      {
+        palloc_free_multiple (slots[i].pages, slots[i].page_cnt);
+        slots[i].pages = NULL;
+      }
+}
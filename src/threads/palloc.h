@@ -11,10 +11,21 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* How short of free pages a pool is.  See pressure.c. */
+enum palloc_pressure
+  {
+    PRESSURE_NONE,              /* At or above the low watermark. */
+    PRESSURE_LOW,               /* Below low, reclaim is running. */
+    PRESSURE_MIN                /* Below min, only needed allocations. */
+  };
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+enum palloc_pressure palloc_pressure (enum palloc_flags);
+size_t palloc_reclaim_target (enum palloc_flags);
+void palloc_bench (void);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,148 @@
+#include "threads/pressure.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Memory pressure.  The page allocator keeps three watermarks on
+   the free pages of each pool (see palloc.c): min < low < high.
+   When an allocation leaves a pool below its low watermark, it
+   wakes the reclaimer thread.  The reclaimer calls the shrinkers
+   that free pages of that pool until the pool is back at its high
+   watermark, or until none of them can free anything more.  Since
+   this starts before the pool runs dry, most allocations never see
+   it fail.
+
+   Allocations that are only an optimization back off under
+   pressure (see palloc_pressure()), so that what is left goes to
+   allocations that are needed: fault-around stops once the user
+   pool is below its low watermark, and the compressed swap pool
+   stops growing once the kernel pool is below its min watermark. */
+
+/* Registered shrinkers.  Subsystems register as they initialize,
+   some before the reclaimer runs. */
+static struct list shrinkers = LIST_INITIALIZER (shrinkers);
+
+/* Reclaimer thread, and the semaphore it sleeps on. */
+static struct semaphore wake;
+static bool started;
+static bool pending;
+
+/* Statistics. */
+static long long wake_cnt;      /* Times the reclaimer was woken. */
+static long long stall_cnt;     /* Passes no shrinker could help. */
+
+static void reclaimer (void *aux);
+static void reclaim (enum palloc_flags);
+
+/* Starts the reclaimer thread.  The scheduler must be running. */
+void
+pressure_init (void)
+{
+  sema_init (&wake, 0);
+  started = true;
+  thread_create ("reclaim", PRI_DEFAULT, reclaimer, NULL);
+}
+
+/* Adds S to the shrinkers called under memory pressure. */
+void
+shrinker_register (struct shrinker *s)
+{
+  enum intr_level old_level;
+
+  ASSERT (s->shrink != NULL);
+  s->freed = 0;
+  old_level = intr_disable ();
+  list_push_back (&shrinkers, &s->elem);
+  intr_set_level (old_level);
+}
+
+/* Wakes the reclaimer, unless it has been woken already or is not
+   running yet.  Called by the page allocator, so it must not
+   allocate or take locks. */
+void
+pressure_wake (void)
+{
+  enum intr_level old_level;
+
+  if (!started)
+    return;
+  old_level = intr_disable ();
+  if (!pending)
+    {
+      pending = true;
+      wake_cnt++;
+      sema_up (&wake);
+    }
+  intr_set_level (old_level);
+}
+
+/* Reclaimer thread: brings every pool back to its high
+   watermark whenever it is woken. */
+static void
+reclaimer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&wake);
+      pending = false;
+      reclaim (0);
+      reclaim (PAL_USER);
+    }
+}
+
+/* Calls the shrinkers of the pool selected by FLAGS until it is
+   back at its high watermark. */
+static void
+reclaim (enum palloc_flags flags)
+{
+  bool user = (flags & PAL_USER) != 0;
+  size_t need;
+
+  while ((need = palloc_reclaim_target (flags)) > 0)
+    {
+      struct list_elem *e;
+      size_t freed = 0;
+
+      /* The list only grows, at the back, so walking it while
+         shrinkers run is safe. */
+      for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+           e = list_next (e))
+        {
+          struct shrinker *s = list_entry (e, struct shrinker, elem);
+          size_t n;
+
+          if (s->user != user)
+            continue;
+          n = s->shrink (need - freed);
+          s->freed += n;
+          freed += n;
+          if (freed >= need)
+            break;
+        }
+      if (freed == 0)
+        {
+          stall_cnt++;
+          break;
+        }
+    }
+}
+
+/* Prints reclaim statistics. */
+void
+pressure_print_stats (void)
+{
+  struct list_elem *e;
+
+  printf ("Reclaim: woken %lld times, %lld passes freed nothing\n",
+          wake_cnt, stall_cnt);
+  for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+       e = list_next (e))
+    {
+      struct shrinker *s = list_entry (e, struct shrinker, elem);
+      printf ("Shrinker %s: %lld %s pages freed\n",
+              s->name, s->freed, s->user ? "user" : "kernel");
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef THREADS_PRESSURE_H
+#define THREADS_PRESSURE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Memory pressure and reclaim.  See pressure.c. */
+
+/* Frees up to NR pages of memory a subsystem can do without, and
+   returns how many it freed.  Called from the reclaimer thread,
+   with no locks held. */
+typedef size_t shrink_func (size_t nr);
+
+/* A subsystem that can give memory back under pressure. */
+struct shrinker
+  {
+    const char *name;           /* Name, for statistics. */
+    shrink_func *shrink;        /* Frees pages. */
+    bool user;                  /* Frees user pool pages? */
+    long long freed;            /* Pages freed so far. */
+    struct list_elem elem;      /* In shrinker list. */
+  };
+
+void pressure_init (void);
+void shrinker_register (struct shrinker *);
+void pressure_wake (void);
+void pressure_print_stats (void);
+
+#endif /* threads/pressure.h */
@@ -66,6 +66,11 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PDE_PS 0x80             /* 1=4 MB page, 0=page table (PDEs only). */
+#define PTE_G 0x100             /* 1=global, kept across CR3 loads. */
+
+/* Size of the region mapped by a single 4 MB PDE. */
+#define LARGE_PGSIZE (1 << PDSHIFT)
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -73,10 +78,20 @@ static inline uint32_t pde_create (uint32_t *pt) {
   return vtop (pt) | PTE_U | PTE_P | PTE_W;
 }
 
+/* Returns a PDE that maps the 4 MB region starting at PAGE
+   directly, without a page table.  The region is writable and
+   usable only by the kernel.  Requires CR4.PSE; see [IA32-v3a]
+   3.7.3 "Mixing 4-KByte and 4-MByte Pages". */
+static inline uint32_t pde_create_large (void *page) {
+  ASSERT (((uintptr_t) page & (LARGE_PGSIZE - 1)) == 0);
+  return vtop (page) | PDE_PS | PTE_P | PTE_W;
+}
+
 /* Returns a pointer to the page table that page directory entry
    PDE, which must "present", points to. */
 static inline uint32_t *pde_get_pt (uint32_t pde) {
   ASSERT (pde & PTE_P);
+  ASSERT (!(pde & PDE_PS));
   return ptov (pde & PTE_ADDR);
 }
 
@@ -0,0 +1,246 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/pressure.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator.  Hands out objects of one size from a named
+   cache, for structures allocated often enough that rounding
+   them up to a malloc() block size wastes memory.
+
+   Each cache carves pages from the kernel pool ("slabs") into
+   objects of exactly its size.  A slab starts with a header,
+   followed by its objects; free objects are chained through
+   their first word.  Slabs with free objects are on the cache's
+   partial list.  kmem_cache_free() finds the slab from the
+   object's address by rounding down to the page.  A slab whose
+   objects are all free goes back to the page allocator, except
+   for the last one, which the shrinker frees under memory
+   pressure.
+
+   There is only one CPU, so caches are protected by turning
+   interrupts off rather than by a lock.  Lock acquisition itself
+   allocates from caches (see synch.c), which a lock here would
+   make recursive.  The page allocator is called with interrupts
+   on. */
+
+/* Number of caches that can be created. */
+#define KMEM_MAX_CACHES 16
+
+/* Magic number for detecting a bad slab pointer. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* An object cache. */
+struct kmem_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t size;                /* Object size, rounded for alignment. */
+    size_t per_slab;            /* Objects per slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct list partial;        /* Slabs with free objects. */
+    size_t slab_cnt;            /* Slabs allocated. */
+    size_t active;              /* Objects handed out. */
+    size_t peak;                /* Highest value of active. */
+    long long alloc_cnt;        /* Calls to kmem_cache_alloc(). */
+  };
+
+/* A slab, at the start of its page. */
+struct slab
+  {
+    unsigned magic;             /* Detects bad pointers. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* In cache's partial list. */
+    void *free;                 /* First free object. */
+    size_t free_cnt;            /* Number of free objects. */
+  };
+
+static struct kmem_cache caches[KMEM_MAX_CACHES];
+static size_t cache_cnt;
+
+static size_t kmem_shrink (size_t nr);
+static struct shrinker kmem_shrinker =
+  { .name = "slab", .shrink = kmem_shrink };
+
+/* Returns the first object of slab S. */
+static uint8_t *
+slab_objects (struct slab *s)
+{
+  return (uint8_t *) s + ROUND_UP (sizeof *s, sizeof (void *));
+}
+
+/* Creates and returns a cache of objects of SIZE bytes, called
+   NAME.  If CTOR is nonnull, it is run on each object that
+   kmem_cache_alloc() returns.  Caches are never destroyed. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+  enum intr_level old_level;
+
+  ASSERT (size > 0);
+  size = ROUND_UP (size < sizeof (void *) ? sizeof (void *) : size,
+                   sizeof (void *));
+  ASSERT (size <= PGSIZE - ROUND_UP (sizeof (struct slab), sizeof (void *)));
+
+  old_level = intr_disable ();
+  if (cache_cnt >= KMEM_MAX_CACHES)
+    PANIC ("too many object caches, cannot create `%s'", name);
+  c = &caches[cache_cnt++];
+  intr_set_level (old_level);
+
+  c->name = name;
+  c->size = size;
+  c->per_slab = (PGSIZE - ROUND_UP (sizeof (struct slab), sizeof (void *)))
+                / size;
+  c->ctor = ctor;
+  list_init (&c->partial);
+  c->slab_cnt = 0;
+  c->active = c->peak = 0;
+  c->alloc_cnt = 0;
+  if (c == &caches[0])
+    shrinker_register (&kmem_shrinker);
+  return c;
+}
+
+/* Obtains an object from cache C and returns it, or a null
+   pointer if memory is exhausted. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  enum intr_level old_level;
+  struct slab *s;
+  void *obj;
+
+  ASSERT (c != NULL);
+  old_level = intr_disable ();
+  if (list_empty (&c->partial))
+    {
+      /* Make a new slab. */
+      uint8_t *p;
+      size_t i;
+
+      intr_set_level (old_level);
+      s = palloc_get_page (0);
+      if (s == NULL)
+        return NULL;
+      s->magic = SLAB_MAGIC;
+      s->cache = c;
+      s->free = NULL;
+      s->free_cnt = c->per_slab;
+      for (i = 0, p = slab_objects (s); i < c->per_slab; i++, p += c->size)
+        {
+          *(void **) p = s->free;
+          s->free = p;
+        }
+      old_level = intr_disable ();
+      list_push_front (&c->partial, &s->elem);
+      c->slab_cnt++;
+    }
+
+  s = list_entry (list_front (&c->partial), struct slab, elem);
+  obj = s->free;
+  s->free = *(void **) obj;
+  if (--s->free_cnt == 0)
+    list_remove (&s->elem);
+  if (++c->active > c->peak)
+    c->peak = c->active;
+  c->alloc_cnt++;
+  intr_set_level (old_level);
+
+  if (c->ctor != NULL)
+    c->ctor (obj);
+  return obj;
+}
+
+/* Returns OBJ, obtained from cache C, to C.  A null pointer is
+   ignored. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  enum intr_level old_level;
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC && s->cache == c);
+
+  old_level = intr_disable ();
+  *(void **) obj = s->free;
+  s->free = obj;
+  if (s->free_cnt++ == 0)
+    list_push_front (&c->partial, &s->elem);
+  c->active--;
+
+  /* Keep one free slab around, give back the others. */
+  if (s->free_cnt == c->per_slab && c->slab_cnt > 1)
+    {
+      list_remove (&s->elem);
+      c->slab_cnt--;
+      s->magic = 0;
+      intr_set_level (old_level);
+      palloc_free_page (s);
+      return;
+    }
+  intr_set_level (old_level);
+}
+
+/* Shrinker: frees the free slab each cache keeps, up to NR of
+   them. */
+static size_t
+kmem_shrink (size_t nr)
+{
+  size_t freed = 0;
+  size_t i;
+
+  for (i = 0; i < cache_cnt && freed < nr; i++)
+    {
+      struct kmem_cache *c = &caches[i];
+      struct slab *empty = NULL;
+      enum intr_level old_level;
+      struct list_elem *e;
+
+      old_level = intr_disable ();
+      for (e = list_begin (&c->partial); e != list_end (&c->partial);
+           e = list_next (e))
+        {
+          struct slab *s = list_entry (e, struct slab, elem);
+          if (s->free_cnt == c->per_slab)
+            {
+              list_remove (&s->elem);
+              c->slab_cnt--;
+              s->magic = 0;
+              empty = s;
+              break;
+            }
+        }
+      intr_set_level (old_level);
+      if (empty != NULL)
+        {
+          palloc_free_page (empty);
+          freed++;
+        }
+    }
+  return freed;
+}
+
+/* Prints object cache statistics. */
+void
+kmem_print_stats (void)
+{
+  size_t i;
+
+  for (i = 0; i < cache_cnt; i++)
+    {
+      struct kmem_cache *c = &caches[i];
+      printf ("Slab %s: %zu-byte objects, %zu in use (peak %zu), "
+              "%zu slabs, %lld allocations\n",
+              c->name, c->size, c->active, c->peak, c->slab_cnt,
+              c->alloc_cnt);
+    }
+}
@@ -32,7 +32,25 @@
 // #include <stdlib.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+
+/* Caches for the priority donation bookkeeping of lock_acquire(). */
+static struct kmem_cache *waiting_cache, *donation_cache, *chain_cache;
+/* Creates the object caches used by lock_acquire().  Must be
+   called before a second thread can contend for a lock. */
+void
+synch_init (void)
+{
+  waiting_cache = kmem_cache_create ("waiting lock",
+                                     sizeof (struct waiting_locks_elem), NULL);
+  donation_cache = kmem_cache_create ("donation",
+                                      sizeof (struct locksAndPriorities_elem),
+                                      NULL);
+  chain_cache = kmem_cache_create ("donation chain",
+                                   sizeof (struct thread_lock_list_elem),
+                                   NULL);
+}
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -217,7 +235,7 @@ lock_acquire (struct lock *lock)
   if (lock->holder !=NULL)
   {
     //lock owned by some other thread. add the lock in the waiting list of crrent thread
-    struct waiting_locks_elem *w=malloc(sizeof ( struct waiting_locks_elem));
+    struct waiting_locks_elem *w=kmem_cache_alloc (waiting_cache);
     w->lock=lock;
     list_push_back(&thread_current()->waiting_locks,&w->elem);
 
@@ -242,7 +260,7 @@ lock_acquire (struct lock *lock)
       }
       if (exist==0)
       {
-        struct locksAndPriorities_elem *s= malloc (sizeof (struct locksAndPriorities_elem) );
+        struct locksAndPriorities_elem *s= kmem_cache_alloc (donation_cache);
         s->lock=lock;
         s->priority=thread_current()->priority;//new value of priority
         // s->priority=(lock->holder)->priority;//old value of priority
@@ -253,7 +271,7 @@ lock_acquire (struct lock *lock)
       //implement nested donoations
       struct list queue;
       list_init(&queue);
-      struct thread_lock_list_elem *st=malloc(sizeof(struct thread_lock_list_elem));
+      struct thread_lock_list_elem *st=kmem_cache_alloc (chain_cache);
       st->thread=lock->holder;
       st->lock=lock;
       list_push_back(&queue, &st->elem);
@@ -283,12 +301,12 @@ lock_acquire (struct lock *lock)
         for ( e = list_begin (&t->thread->waiting_locks); e != list_end (&t->thread->waiting_locks);  e = list_next (e))
         {
           struct waiting_locks_elem *ws=list_entry(e,struct waiting_locks_elem, elem);
-          struct thread_lock_list_elem *st=malloc(sizeof(struct thread_lock_list_elem));
+          struct thread_lock_list_elem *st=kmem_cache_alloc (chain_cache);
           st->thread=ws->lock->holder;
           st->lock=ws->lock;
           list_push_back(&queue, &st->elem);
         }
-        free(t);
+        kmem_cache_free (chain_cache, t);
       }
       // list_sort(&ready_list,&compare_priority,NULL);
     }
@@ -304,7 +322,7 @@ lock_acquire (struct lock *lock)
     {
       //remove this
       list_remove(e);
-      free(w);
+      kmem_cache_free (waiting_cache, w);
       break;
     }
   }
@@ -351,7 +369,7 @@ lock_release (struct lock *lock)
     if (s->lock==lock)
     {
       list_remove(e);
-      free(s);
+      kmem_cache_free (donation_cache, s);
       if (list_empty(&lock->holder->locksAndPriorities))
       {
         lock->holder->priority=lock->holder->first_priority;
@@ -381,47 +399,89 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* Reader-writer lock implementation - simple. For the
-   file system assignment implementing synchronization.
- */
-void rwlock_init (struct rwlock *l) {
-   ASSERT(l != NULL);
+/* Initializes RW as a reader-writer lock.  Any number of readers
+   may hold it at once, or a single writer.  A waiting writer
+   keeps new readers out, so that a steady stream of readers
+   cannot starve it.
 
-   l->read_count = 0;
-   lock_init(&l->read_lock);
-   lock_init(&l->write_lock);
+   Unlike a lock, a reader-writer lock may be released by a
+   different thread than the one that acquired it first: readers
+   come and go in any order.  It does not donate priority. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers_ok);
+  cond_init (&rw->writers_ok);
+  rw->readers = 0;
+  rw->writers_waiting = 0;
+  rw->writer = NULL;
 }
 
-void rwlock_read_acquire (struct rwlock *l) {
-   ASSERT(l != NULL);
+/* Acquires RW for reading, sleeping until no writer holds it or
+   waits for it. */
+void
+rwlock_read_acquire (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
 
-   lock_acquire(&l->read_lock);
-   if(l->read_count == 0)
-         lock_acquire(&l->write_lock);
-   l->read_count++;
-   lock_release(&l->read_lock);
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL || rw->writers_waiting > 0)
+    cond_wait (&rw->readers_ok, &rw->lock);
+  rw->readers++;
+  lock_release (&rw->lock);
 }
 
-void rwlock_read_release (struct rwlock *l) {
-   ASSERT(l != NULL);
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_read_release (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
 
-   lock_acquire(&l->read_lock);
-   l->read_count--;
-   if(l->read_count == 0)
-         lock_release(&l->write_lock);
-   lock_release(&l->read_lock);
+  lock_acquire (&rw->lock);
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0)
+    cond_signal (&rw->writers_ok, &rw->lock);
+  lock_release (&rw->lock);
 }
 
-void rwlock_write_acquire (struct rwlock *l) {
-   ASSERT(l != NULL);
-   lock_acquire(&l->write_lock);
+/* Acquires RW for writing, sleeping until nobody else holds it. */
+void
+rwlock_write_acquire (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->writer != thread_current ());
+  rw->writers_waiting++;
+  while (rw->writer != NULL || rw->readers > 0)
+    cond_wait (&rw->writers_ok, &rw->lock);
+  rw->writers_waiting--;
+  rw->writer = thread_current ();
+  lock_release (&rw->lock);
 }
 
-void rwlock_write_release (struct rwlock *l) {
-   ASSERT(l != NULL);
-   lock_release(&l->write_lock);
+/* Releases RW, which the current thread holds for writing.
+   Hands it to the next writer if there is one, otherwise to all
+   waiting readers. */
+void
+rwlock_write_release (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->writer == thread_current ());
+  rw->writer = NULL;
+  if (rw->writers_waiting > 0)
+    cond_signal (&rw->writers_ok, &rw->lock);
+  else
+    cond_broadcast (&rw->readers_ok, &rw->lock);
+  lock_release (&rw->lock);
 }
-
 
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
@@ -17,6 +17,8 @@ struct semaphore
       struct semaphore semaphore;         /* This semaphore. */
     };
 
+void synch_init (void);
+
 void sema_init (struct semaphore *, unsigned value);
 void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
@@ -36,20 +38,6 @@ bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
-/* RWLock. */
-struct rwlock
-  {
-    unsigned read_count; /* number of readers holding the lock */
-    struct lock read_lock; /* readers access. */
-    struct lock write_lock; /* writers access. */
-  };
-
-void rwlock_init (struct rwlock *);
-void rwlock_read_acquire (struct rwlock *);
-void rwlock_read_release (struct rwlock *);
-void rwlock_write_acquire (struct rwlock *);
-void rwlock_write_release (struct rwlock *);
-
 /* Condition variable. */
 struct condition
   {
@@ -61,6 +49,23 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers_ok; /* Signaled when readers may enter. */
+    struct condition writers_ok; /* Signaled when a writer may enter. */
+    unsigned readers;           /* Readers holding the lock. */
+    unsigned writers_waiting;   /* Writers waiting for it. */
+    struct thread *writer;      /* Writer holding it, or null. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_read_acquire (struct rwlock *);
+void rwlock_read_release (struct rwlock *);
+void rwlock_write_acquire (struct rwlock *);
+void rwlock_write_release (struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -16,6 +16,7 @@
 #endif
 #ifdef VM
 #include "vm/sup_page.h"
+#include "vm/frame.h"
 #endif
 
 //global varoable for maximum priority
@@ -139,6 +140,11 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+#ifdef VM
+  /* Sample working sets. */
+  frame_tick ();
+#endif
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
@@ -325,14 +331,18 @@ thread_exit (void)
 {
   ASSERT (!intr_context ());
 
+#ifdef VM
+  /* clean up the supplemental page table. Must come before the
+     page directory is destroyed, frames can be shared. */
+  sup_page_table_destroy();
+#endif
+
 #ifdef USERPROG
   process_exit ();
 #endif
 
-#ifdef VM
-  /* clean up the supplemental page table */
-  sup_page_table_destroy();
-#endif
+  /* Give back the blocks cached for this thread. */
+  malloc_thread_exit ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -565,9 +575,12 @@ init_thread (struct thread *t, const char *name, int priority)
   /* adjusts the name - for make check */
   char* savep;
   strtok_r(t->name," ",&savep);
+  list_init(&t->children);
+  t->exit_code = -1;
 #endif
 #ifdef VM
   list_init(&(t->sup_page_table));
+  t->rss_limit = FRAME_RSS_MIN;
 #endif
   intr_set_level (old_level);
 }
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/malloc.h"
 #include "threads/synch.h"
 
 //multiple priority donation working
@@ -114,16 +115,40 @@ struct thread
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
+    /* Owned by malloc.c. */
+    struct malloc_tcache tcache;        /* Free blocks of this thread. */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct list children;               /* Exit status of children. */
+    struct child_status *cs;            /* Own exit status, for parent. */
+    int exit_code;                      /* Status passed to exit(). */
+    struct dir *cwd;                    /* Working directory, or null
+                                           for the root directory. */
+#endif
 
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Journal operations open. */
 #endif
 
 #ifdef VM
     /* supplemental page table, elements from vm/sup_page.h,.c */
     struct list sup_page_table;
     struct file* execfile;
+    /* read-ahead of executable pages, see page_fault */
+    unsigned ra_next; /* page number a sequential fault would hit */
+    unsigned ra_window; /* pages to read ahead on it */
+    /* resident set and working set, see vm/frame.c */
+    size_t rss; /* frames mapped by this process */
+    size_t rss_peak;
+    size_t rss_limit; /* above this, replace own pages first */
+    size_t wss; /* pages referenced in the last few samples */
+    size_t ws_sample; /* wss being counted by the current sample */
+    unsigned pf_window; /* page faults since the last sample */
+    unsigned pf_rate; /* page faults in the last sample window */
+    unsigned pf_total;
 #endif
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
@@ -15,6 +15,23 @@
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+#ifdef VM
+/* Fault-around: on a fault on an executable page, neighbours in an
+   aligned block of FAULT_AROUND_PAGES that some other process has
+   loaded already are mapped too. Sequential faults also read ahead
+   a window of pages that doubles up to READAHEAD_MAX. */
+#define FAULT_AROUND_PAGES 8
+#define READAHEAD_MAX 16
+
+static long long faultaround_cnt; /* pages mapped from the page cache */
+static long long readahead_cnt;   /* pages read ahead */
+static long long prefetch_used_cnt; /* of both, touched by their process */
+
+static void fault_around(struct sup_page* spg);
+static bool load_page_from(struct sup_page* spg, uint8_t* va, bool write,
+                           bool evict);
+#endif
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 
@@ -72,8 +89,24 @@ void
 exception_print_stats (void) 
 {
   printf ("Exception: %lld page faults\n", page_fault_cnt);
+#ifdef VM
+  printf ("Fault-around: %lld pages mapped, %lld read ahead, "
+          "%lld used\n",
+          faultaround_cnt, readahead_cnt, prefetch_used_cnt);
+#endif
 }
 
+#ifdef VM
+/* Counts a page mapped ahead of time that its process went on to
+   touch, i.e. one page fault saved. Called by the frame table the
+   first time it finds the page accessed. */
+void
+exception_count_prefetch_use (void)
+{
+  prefetch_used_cnt++;
+}
+#endif
+
 /* Handler for an exception (probably) caused by a user process. */
 static void
 kill (struct intr_frame *f) 
@@ -117,15 +150,20 @@ kill (struct intr_frame *f)
 #ifdef VM
 /* 8MB stack max */
 #define STACK_LIMIT (2048*PGSIZE)
-/* helper - grows the stack by allocating a page and installs it */
-bool grow_stack(uint8_t* va) {
+/* helper - grows the stack by allocating a page and installs it.
+   A page that is only read gets the shared zero frame for now. */
+bool grow_stack(uint8_t* va, bool write) {
   uint8_t* ua = PFNO_TO_ADDR(ADDR_TO_PFNO(va));
   if(ua > (uint8_t*)PHYS_BASE - PGSIZE || ua < (uint8_t*)PHYS_BASE - STACK_LIMIT) 
     return false;
   /* new page needed */
   struct sup_page* spg = new_zero_sup_page(ua);
+  if(spg == NULL)
+    return false;
+  if(!write)
+    return frame_map_zero(spg) != NULL;
   uint8_t* pa = frame_map(ua, PAL_USER|PAL_ZERO);
-  if(pa == NULL || spg == NULL)
+  if(pa == NULL)
     return false;
   spg->frame_no = ADDR_TO_PFNO(pa);
   /* install this as well */
@@ -186,54 +224,85 @@ page_fault (struct intr_frame *f)
 
 #endif 
 
-  /* For second option in the pintos doc 3.1.5 Accesing User Memory */
-  if(!user) {
-    /* Kernel page fault, sets eax to -1 */
-    f->eip = (void (*)(void))f->eax;
-    f->eax = 0xffffffff;
-    return;
-  }
-
 #ifdef VM
-  if(fault_addr == NULL)
-      goto fail; /* cover a few cases directly */
-
-  if(not_present) {
+  /* Write to a copy-on-write page, from user code or from the kernel
+     copying into a user buffer. */
+  if(!not_present && write && is_user_vaddr(fault_addr)) {
+    struct sup_page* spg = lookup_page(pg_round_down(fault_addr));
+    if(spg != NULL && spg->cow && frame_cow_break(spg))
+      return;
+  }
 
+  /* A page not present: on DISK, in SWAP, or stack to grow. The kernel
+     faults here as well when a page it validated for a syscall got
+     evicted meanwhile. */
+  if(not_present && fault_addr != NULL && is_user_vaddr(fault_addr)) {
     uint8_t* va = PFNO_TO_ADDR(ADDR_TO_PFNO(fault_addr));
     struct sup_page* spg = lookup_page(va);
+    struct thread* t = thread_current();
+    t->pf_window++;
+    t->pf_total++;
     if(spg == NULL) {
       /* This might be a stack access. check it here */
-      if(fault_addr == f->esp-4 /* push */ ||
+      if(user && (fault_addr == f->esp-4 /* push */ ||
          fault_addr == f->esp-32 /* pusha */ || 
-         fault_addr >= f->esp /* access in stack */) {
+         fault_addr >= f->esp /* access in stack */)) {
          /* Try to grow stack */
-         if(grow_stack(va)) return;
+         if(grow_stack(va, write)) return;
       }
       /* This page is not stack and has no mapping: a bad access.*/
-      goto fail;
-    }
-    /* A page exists in the supp page table. Might be on DISK. */
-    if(spg->location & DISK) {
-      if(load_page(spg, va)) return;
-      else PANIC("Could not load_page in page_fault!");
+    } else if(spg->location & SWAP) {
+      if(frame_swap_in(spg))
+        return;
+    } else if(spg->location & DISK) {
+      /* A page exists in the supp page table. Might be on DISK. */
+      if(load_page(spg, va, write)) {
+        fault_around(spg);
+        return;
+      }
     } /* Done handling DISK page */
+    /* Out of memory or a read error: the access fails below, which
+       kills a user process or fails the system call, not the kernel. */
   }
-
-fail:
 #endif
 
+  /* For second option in the pintos doc 3.1.5 Accesing User Memory */
+  if(!user) {
+    /* Kernel page fault, sets eax to -1 */
+    f->eip = (void (*)(void))f->eax;
+    f->eax = 0xffffffff;
+    return;
+  }
+
   kill (f);
 }
 
 #ifdef VM
-bool load_page(struct sup_page* spg, uint8_t* va) {
+bool load_page(struct sup_page* spg, uint8_t* va, bool write) {
+  return load_page_from(spg, va, write, true);
+}
+
+/* helper - loads SPG at VA from the executable. Without EVICT only
+   free frames are used, and false is returned if there are none.
+   Pages with nothing to read are mapped to the zero frame until
+   they are first WRITTEN. */
+static bool load_page_from(struct sup_page* spg, uint8_t* va, bool write,
+                           bool evict) {
       ASSERT(spg->location & DISK);
+      if(spg->read_bytes == 0 && !write)
+        return frame_map_zero(spg) != NULL;
       struct file* pfile = thread_current()->execfile;
+      struct inode* inode = file_get_inode(pfile);
+
+      /* Read-only pages are shared between all processes running
+         the same executable - maybe it is loaded already */
+      if(!spg->writable && frame_share(inode, spg->offset, spg))
+        return true;
 
       /* Now let's do all the loading work */
       /* Get a page of memory */
-      uint8_t *kpage = frame_map(va, PAL_USER);
+      uint8_t *kpage = evict ? frame_map(va, PAL_USER)
+                             : frame_try_map(va, PAL_USER);
       if(kpage == NULL) 
         return false;
       /* Load the page */
@@ -244,6 +313,8 @@ bool load_page(struct sup_page* spg, uint8_t* va) {
       }
       /* Set the rest of the page to 0 */
       memset (kpage + spg->read_bytes, 0, PGSIZE - spg->read_bytes);
+      if(!spg->writable)
+        return frame_publish(kpage, inode, spg->offset, spg) != NULL;
       /* Add the page to the process's address space. */
       if (!install_page (va, kpage, spg->writable)) { 
         frame_free(kpage);
@@ -255,4 +326,47 @@ bool load_page(struct sup_page* spg, uint8_t* va) {
       return true;
 }
 
+/* helper - maps the neighbours of the just loaded page SPG, see
+   FAULT_AROUND_PAGES, and reads ahead on sequential faults. Best
+   effort: stops as soon as memory is short. */
+static void fault_around(struct sup_page* spg) {
+  struct thread* t = thread_current();
+  struct inode* inode = file_get_inode(t->execfile);
+  unsigned pn = spg->page_no;
+  unsigned first = pn & ~(unsigned)(FAULT_AROUND_PAGES - 1);
+  unsigned p, k;
+
+  /* Neighbours shared by someone else cost no I/O at all */
+  for(p = first; p < first + FAULT_AROUND_PAGES; p++) {
+    struct sup_page* n = lookup_page(PFNO_TO_ADDR(p));
+    if(p == pn || n == NULL || !(n->location & DISK) || n->writable)
+      continue;
+    if(frame_share(inode, n->offset, n)) {
+      frame_mark_prefetched(n);
+      faultaround_cnt++;
+    }
+  }
+
+  /* Grow the window while faults stay sequential */
+  if(pn == t->ra_next && t->ra_window > 0)
+    t->ra_window = t->ra_window * 2 > READAHEAD_MAX ? READAHEAD_MAX
+                                                    : t->ra_window * 2;
+  else
+    t->ra_window = 1;
+
+  /* Read ahead while the pages continue the same segment in the file */
+  for(k = 1; k <= t->ra_window; k++) {
+    struct sup_page* n = lookup_page(PFNO_TO_ADDR(pn + k));
+    if(n == NULL || n->writable != spg->writable || n->read_bytes == 0
+       || n->offset != spg->offset + (off_t)(k * PGSIZE))
+      break;
+    if(!(n->location & DISK))
+      continue; /* mapped already */
+    if(!load_page_from(n, PFNO_TO_ADDR(pn + k), false, false))
+      break;
+    frame_mark_prefetched(n);
+    readahead_cnt++;
+  }
+  t->ra_next = pn + k;
+}
 #endif
@@ -12,9 +12,10 @@ void exception_init (void);
 void exception_print_stats (void);
 
 #ifdef VM
-bool grow_stack(uint8_t* );
+bool grow_stack(uint8_t* , bool write);
 struct sup_page;
-bool load_page(struct sup_page* , uint8_t* );
+bool load_page(struct sup_page* , uint8_t* , bool write);
+void exception_count_prefetch_use (void);
 #endif
 
 #endif /* userprog/exception.h */
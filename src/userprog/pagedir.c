@@ -6,7 +6,12 @@
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
+/* Whether to skip loading a page directory that is already
+   loaded.  Cleared by `-o no-lazy-cr3'. */
+bool pagedir_lazy_cr3 = true;
+
 static uint32_t *active_pd (void);
+static void load_pd (uint32_t *);
 static void invalidate_pagedir (uint32_t *);
 
 /* Creates a new page directory that has mappings for kernel
@@ -214,19 +219,45 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
     }
 }
 
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL) 
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else 
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_pagedir (pd);
+    }
+}
+
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is already loaded and pagedir_lazy_cr3 is
+   set.  Reloading the same page directory would only flush the
+   TLB for nothing. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = init_page_dir;
 
-  /* Store the physical address of the page directory into CR3
-     aka PDBR (page directory base register).  This activates our
-     new page tables immediately.  See [IA32-v2a] "MOV--Move
-     to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
-     Address of the Page Directory". */
+  if (!pagedir_lazy_cr3 || active_pd () != pd)
+    load_pd (pd);
+}
+
+/* Stores the physical address of page directory PD into CR3
+   aka PDBR (page directory base register).  This activates our
+   new page tables immediately and flushes all TLB entries other
+   than global ones.  See [IA32-v2a] "MOV--Move to/from Control
+   Registers" and [IA32-v3a] 3.7.5 "Base Address of the Page
+   Directory". */
+static void
+load_pd (uint32_t *pd) 
+{
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
 }
 
@@ -256,8 +287,8 @@ invalidate_pagedir (uint32_t *pd)
 {
   if (active_pd () == pd) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
+      /* Reloading PD clears the TLB.  See [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      load_pd (pd);
     } 
 }
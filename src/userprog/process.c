@@ -19,6 +19,7 @@
 #include "threads/vaddr.h"
 #include "threads/synch.h"
 #include "threads/malloc.h"
+#include "threads/memtrack.h"
 #ifdef VM
 #include "vm/frame.h"
 #include "vm/sup_page.h"
@@ -26,15 +27,95 @@
 
 #define MAX_ARGS (32)
 static thread_func start_process NO_RETURN;
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+#endif
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
+/* Exit status of a child process, shared between the child and
+   its parent.  Freed by whichever of the two drops it last. */
+struct child_status
+  {
+    tid_t tid;                          /* Child's thread id. */
+    int exit_code;                      /* Valid once DEAD is up. */
+    struct semaphore dead;              /* Upped when the child exits. */
+    int refs;                           /* Parent and/or child. */
+    struct list_elem elem;              /* In parent's children list. */
+  };
+
+/* Handed from a parent to the thread of a new process. */
+struct process_start
+  {
+    char *cmd_line;                     /* exec: command line page. */
+    struct thread *parent;              /* fork: process to copy. */
+    struct dir *cwd;                    /* Parent's working directory. */
+    const struct intr_frame *if_;       /* fork: parent's registers. */
+    struct child_status *cs;            /* Exit status of the child. */
+    struct semaphore started;           /* Upped after load/copy. */
+    bool success;                       /* Result of load/copy. */
+  };
+
+/* Drops one reference to CS, freeing it with the last one. */
+static void
+child_status_release (struct child_status *cs)
+{
+  enum intr_level old_level = intr_disable ();
+  bool last = --cs->refs == 0;
+  intr_set_level (old_level);
+  if (last)
+    free (cs);
+}
+
+/* Creates a thread named NAME running FUNCTION for a new child
+   process of the running thread, and waits until it has loaded
+   or copied its address space.  Returns the child's tid, or
+   TID_ERROR if that failed. */
+static tid_t
+spawn_child (const char *name, thread_func *function,
+             struct process_start *ps)
+{
+  struct thread *cur = thread_current ();
+  tid_t tid;
+
+  /* PS->cs stays NULL if the child never started. */
+  ps->cs = malloc (sizeof *ps->cs);
+  if (ps->cs == NULL)
+    return TID_ERROR;
+  ps->cs->exit_code = -1;
+  ps->cs->refs = 2;
+  ps->cwd = cur->cwd;
+  sema_init (&ps->cs->dead, 0);
+  sema_init (&ps->started, 0);
+  ps->success = false;
+
+  tid = thread_create (name, PRI_DEFAULT, function, ps);
+  if (tid == TID_ERROR)
+    {
+      free (ps->cs);
+      ps->cs = NULL;
+      return TID_ERROR;
+    }
+  ps->cs->tid = tid;
+  list_push_back (&cur->children, &ps->cs->elem);
+
+  sema_down (&ps->started);
+  if (!ps->success)
+    {
+      /* Reap the child right away, it is exiting already. */
+      process_wait (tid);
+      return TID_ERROR;
+    }
+  return tid;
+}
+
 /* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+   FILENAME.  Returns the new process's thread id, or TID_ERROR
+   if the thread cannot be created or the program cannot be
+   loaded. */
 tid_t
 process_execute (const char *file_name)
 {
+  struct process_start ps;
   char *fn_copy;
   tid_t tid;
 
@@ -48,32 +129,57 @@ process_execute (const char *file_name)
     return TID_ERROR;
 
   strlcpy (fn_copy, file_name, PGSIZE);
-
+  ps.cmd_line = fn_copy;
 
   /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  tid = spawn_child (file_name, start_process, &ps);
 
-  // free memory on error
-  if(tid == TID_ERROR) {
+  // free memory on error, start_process owns it otherwise
+  if(tid == TID_ERROR && ps.cs == NULL)
     palloc_free_page (fn_copy);
-  }
 
   return tid;
 }
 
+/* Starts a copy of the running process, sharing all of its pages
+   copy-on-write.  F holds the user registers at the time of the
+   fork system call; the child resumes from there with 0 in eax.
+   Returns the child's thread id, or TID_ERROR on failure. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+#ifdef VM
+  struct process_start ps;
+
+  ps.parent = thread_current ();
+  ps.if_ = f;
+  return spawn_child (ps.parent->name, start_fork, &ps);
+#else
+  /* Without a supplemental page table there is nothing to share. */
+  (void) f;
+  return TID_ERROR;
+#endif
+}
+
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *load_p)
+start_process (void *ps_)
 {
-  char *file_name = load_p;
+  struct process_start *ps = ps_;
+  char *file_name = ps->cmd_line;
+  void *load_p = file_name;
   struct intr_frame if_;
   bool success;
   char *vargs[MAX_ARGS];
   int nargs = 0;
   int argssize = strlen(file_name) + 1;
 
+  thread_current ()->cs = ps->cs;
+  if (ps->cwd != NULL)
+    thread_current ()->cwd = dir_reopen (ps->cwd);
+
   /* tokenize command line */
   char *token, *save_ptr;
   for (token = strtok_r (file_name, " ", &save_ptr); token != NULL;
@@ -89,9 +195,16 @@ start_process (void *load_p)
   if_.eflags = FLAG_IF | FLAG_MBS;
   success = load (vargs[0], &if_.eip, &if_.esp);
 
+  /* Let the parent go on, PS is gone after this. */
+  ps->success = success;
+  sema_up (&ps->started);
+
   /* If load failed, quit. */
   if (!success)
-    thread_exit ();
+    {
+      palloc_free_page (file_name);
+      thread_exit ();
+    }
 
   /* build the stack from the given arguments */
   char* esp = if_.esp;
@@ -134,21 +247,73 @@ start_process (void *load_p)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/* A thread function that starts a process forked from
+   PS->parent.  The parent sleeps until the address space has been
+   copied, so its page tables and registers stay put meanwhile. */
+static void
+start_fork (void *ps_)
+{
+  struct process_start *ps = ps_;
+  struct thread *cur = thread_current ();
+  struct thread *parent = ps->parent;
+  struct intr_frame if_ = *ps->if_;
+  bool success = false;
+
+  cur->cs = ps->cs;
+  if (ps->cwd != NULL)
+    cur->cwd = dir_reopen (ps->cwd);
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir != NULL)
+    {
+      process_activate ();
+      cur->execfile = file_reopen (parent->execfile);
+      if (cur->execfile != NULL)
+        {
+          file_deny_write (cur->execfile);
+          success = sup_page_table_fork (parent);
+        }
+    }
+
+  ps->success = success;
+  sema_up (&ps->started);
+  if (!success)
+    thread_exit ();
+
+  /* fork() returns 0 in the child */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
 process_wait (tid_t child_tid)
 {
-  while (true) {
-    /* code */
-  }
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = list_next (e))
+    {
+      struct child_status *cs = list_entry (e, struct child_status, elem);
+      if (cs->tid == child_tid)
+        {
+          int exit_code;
+          sema_down (&cs->dead);
+          exit_code = cs->exit_code;
+          list_remove (&cs->elem);
+          child_status_release (cs);
+          return exit_code;
+        }
+    }
+  return -1;
 }
 
 /* Free the current process's resources. */
@@ -158,6 +323,33 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  if (cur->pagedir != NULL)
+    printf ("%s: exit(%d)\n", cur->name, cur->exit_code);
+#ifdef VM
+  if (cur->pagedir != NULL && frame_ws_stats)
+    printf ("%s: resident set %zu pages at peak, limit %zu, working set %zu, "
+            "%u page faults, %u in the last window\n",
+            cur->name, cur->rss_peak, cur->rss_limit, cur->wss,
+            cur->pf_total, cur->pf_rate);
+#endif
+
+  /* Report to the parent, and let go of the children. */
+  if (cur->cs != NULL)
+    {
+      cur->cs->exit_code = cur->exit_code;
+      sema_up (&cur->cs->dead);
+      child_status_release (cur->cs);
+      cur->cs = NULL;
+    }
+  while (!list_empty (&cur->children))
+    {
+      struct list_elem *e = list_pop_front (&cur->children);
+      child_status_release (list_entry (e, struct child_status, elem));
+    }
+
+  dir_close (cur->cwd);
+  cur->cwd = NULL;
+
   #ifdef VM
     /* close also the exec file assoiated with this */
     if(cur->execfile)
@@ -179,6 +371,9 @@ process_exit (void)
       cur->pagedir = NULL;
       pagedir_activate (NULL);
       pagedir_destroy (pd);
+
+      /* Whatever is still allocated by this thread now. */
+      memtrack_report_thread (cur->tid);
     }
 }
 
@@ -190,8 +385,13 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  A thread without user
+     memory never touches user addresses and every page directory
+     maps the kernel, so it simply keeps whichever one is loaded
+     and the TLB survives the switch, unless `-o no-lazy-cr3'
+     asks for the base page directory to be loaded anyway. */
+  if (t->pagedir != NULL || !pagedir_lazy_cr3)
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -301,6 +501,8 @@ load (const char *file_name, void (**eip) (void), void **esp)
     }
   #ifdef VM
     t->execfile = file; /* store this for use in pagefault */
+    /* code pages are shared through the page cache, keep them valid */
+    file_deny_write (file);
   #endif
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
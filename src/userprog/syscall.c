@@ -3,12 +3,16 @@
 #include <syscall-nr.h>
 #include <string.h>
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/shutdown.h"
 #include "devices/input.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -20,8 +24,10 @@ struct oFiles_elem
 {
   struct file * file_fd;
   int num_fd;
+  int ref_cnt; /* 1 while in oFiles, +1 per system call using it */
   struct list_elem elem;
 };
+static struct kmem_cache *oFiles_cache;
 struct write_args {
 int num;
 int fd;
@@ -47,17 +53,45 @@ int fd;
 void *buffer;
 unsigned size;
 };
+struct exit_args {
+int num;
+int status;
+};
+struct exec_args {
+int num;
+const char *cmd_line;
+};
+struct wait_args {
+int num;
+int pid;
+};
+struct fd_args {
+int num;
+int fd;
+};
+struct readdir_args {
+int num;
+int fd;
+char *name;
+};
 
 static void syscall_handler (struct intr_frame *);
 static void invalid_access();
 static void my_exit();
 
 struct list oFiles;//files that are open
-struct lock file_lock;
+/* Protects oFiles, numOpenFiles and every ref_cnt. File system calls
+   are not serialized: the file system locks each inode and directory
+   it uses, and struct file locks its own position. A system call holds
+   a reference to the descriptor it uses, so a concurrent close only
+   takes it off oFiles and the last reference closes the file. */
+static struct lock fd_lock;
 void syscall_init (void)
 {
-  lock_init(&file_lock);
+  lock_init(&fd_lock);
   list_init(&oFiles);
+  oFiles_cache = kmem_cache_create("oFiles_elem", sizeof (struct oFiles_elem),
+                                   NULL);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -107,9 +141,10 @@ bool validate_user_addr_range(uint8_t *va, size_t bcnt, uint32_t* esp, bool exac
 #ifdef VM
       uint8_t* uaddr = PFNO_TO_ADDR(ADDR_TO_PFNO(va+i));
       struct sup_page* spg = lookup_page(uaddr);
-      if(spg != NULL && load_page(spg, uaddr)) /* page must be loaded */
+      if(spg != NULL && (spg->location & DISK)
+         && load_page(spg, uaddr, false)) /* page must be loaded */
         continue; /* check next address */
-      if(va+i > (uint8_t*)esp && grow_stack(uaddr)) /* 1st stack access in syscall */
+      if(va+i > (uint8_t*)esp && grow_stack(uaddr, false)) /* 1st stack access in syscall */
         continue; /* check next address*/
       /* none of these situations! */
 #endif
@@ -119,11 +154,121 @@ bool validate_user_addr_range(uint8_t *va, size_t bcnt, uint32_t* esp, bool exac
   return true;
 }
 
-/* File system primitive synchronization. Sequentialize file system accesses. */
-#define FS_ATOMIC(code) \
-  {  fs_take(); \
-     {code} \
-     fs_give(); }
+/* Returns descriptor FD, or NULL if there is none.
+   fd_lock must be held. */
+static struct oFiles_elem *
+find_fd (int fd)
+{
+  struct list_elem *e;
+  for (e = list_begin (&oFiles); e != list_end (&oFiles);
+       e = list_next (e))
+    {
+      struct oFiles_elem *fof = list_entry (e, struct oFiles_elem, elem);
+      if (fof->num_fd == fd)
+        return fof;
+    }
+  return NULL;
+}
+
+/* Returns descriptor FD with a reference taken, or NULL if there is
+   none. The caller must give the reference back with release_fd. */
+static struct oFiles_elem *
+lookup_fd (int fd)
+{
+  struct oFiles_elem *fof;
+  lock_acquire(&fd_lock);
+  fof = find_fd(fd);
+  if (fof != NULL)
+    fof->ref_cnt++;
+  lock_release(&fd_lock);
+  return fof;
+}
+
+/* Gives back a reference to FOF, closing the file if it was the
+   last one. */
+static void
+release_fd (struct oFiles_elem *fof)
+{
+  bool last;
+  lock_acquire(&fd_lock);
+  last = --fof->ref_cnt == 0;
+  lock_release(&fd_lock);
+  if (last) {
+    file_close(fof->file_fd);
+    kmem_cache_free(oFiles_cache, fof);
+  }
+}
+
+/* File data goes between user memory and the file system through a
+   kernel page. A user page may have been evicted since the system call
+   checked it, and faulting it back in reads the executable, so user
+   memory is never touched while the file system holds a cache entry or
+   an inode lock. */
+
+/* Reads up to SIZE bytes from FILE into user buffer UDST. Returns the
+   number of bytes read, or -1 if memory is short. Sets *BAD and
+   returns -1 if UDST turns out to be bad. */
+static int
+read_to_user (struct file *file, uint8_t *udst, unsigned size, bool *bad)
+{
+  uint8_t *bounce = palloc_get_page(0);
+  int total = 0;
+  *bad = false;
+  if (bounce == NULL)
+    return -1;
+  while ((unsigned) total < size) {
+    off_t chunk = size - total < PGSIZE ? size - total : PGSIZE;
+    off_t n = file_read(file, bounce, chunk);
+    for (off_t i = 0; i < n; i++)
+      if (!is_user_vaddr(udst + total + i)
+          || !put_user(udst + total + i, bounce[i])) {
+        *bad = true;
+        total = -1;
+        goto done;
+      }
+    total += n;
+    if (n < chunk)
+      break;
+  }
+ done:
+  palloc_free_page(bounce);
+  return total;
+}
+
+/* Writes up to SIZE bytes from user buffer USRC to FILE. Returns the
+   number of bytes written, or -1 if memory is short. Sets *BAD and
+   returns -1 if USRC turns out to be bad. */
+static int
+write_from_user (struct file *file, const uint8_t *usrc, unsigned size,
+                 bool *bad)
+{
+  uint8_t *bounce = palloc_get_page(0);
+  int total = 0;
+  *bad = false;
+  if (bounce == NULL)
+    return -1;
+  while ((unsigned) total < size) {
+    off_t chunk = size - total < PGSIZE ? size - total : PGSIZE;
+    off_t n;
+    for (off_t i = 0; i < chunk; i++) {
+      int b = is_user_vaddr(usrc + total + i) ? get_user(usrc + total + i)
+                                                : -1;
+      if (b == -1) {
+        *bad = true;
+        total = -1;
+        goto done;
+      }
+      bounce[i] = b;
+    }
+    n = file_write(file, bounce, chunk);
+    total += n;
+    if (n < chunk)
+      break;
+  }
+ done:
+  palloc_free_page(bounce);
+  return total;
+}
 
 static void
 syscall_handler (struct intr_frame *f)
@@ -145,31 +290,21 @@ syscall_handler (struct intr_frame *f)
         }
         else
         {
-          struct list_elem *e;
-          struct file *file_fd;
-          int found_file=0;
-          struct oFiles_elem *fof;
-          for (e = list_begin (&oFiles); e != list_end (&oFiles);
-               e = list_next (e))
-            {
-              // printf("196\n");
-              fof = list_entry (e, struct oFiles_elem, elem);
-              if (fof->num_fd==args->fd) {
-                file_fd=fof->file_fd;
-                found_file=1;
-                break;
-              }
-            }
-          if(found_file==0)
+          struct oFiles_elem *fof = lookup_fd(args->fd);
+          bool bad = false;
+          if(fof == NULL)
           {
             f->eax=-1;
             break;
-            // printf("Error Trying to write a file which might not be open. could not find file descriptor. exiting\n" );
-            // my_exit();
           }
-          lock_acquire(&file_lock);
-          f->eax=file_write(file_fd, args->buffer, args->length);
-          lock_release(&file_lock);
+          if (inode_is_dir (file_get_inode (fof->file_fd)))
+            f->eax=-1; /* directories are written through mkdir etc. */
+          else
+            f->eax=write_from_user(fof->file_fd, args->buffer, args->length,
+                                   &bad);
+          release_fd(fof);
+          if (bad)
+            invalid_access();
         }
         break;
       }
@@ -185,9 +320,32 @@ syscall_handler (struct intr_frame *f)
       }
     case SYS_EXIT:
       {
+        struct exit_args *args = (struct exit_args *) f->esp;
+        thread_current()->exit_code = args->status;
         my_exit();
         // break;
       }
+    case SYS_EXEC:
+      {
+        struct exec_args *args = (struct exec_args *) f->esp;
+        if(!validate_user_addr_range(args->cmd_line,1, f->esp, false))
+          {
+            invalid_access();
+          }
+        f->eax=process_execute(args->cmd_line);
+        break;
+      }
+    case SYS_WAIT:
+      {
+        struct wait_args *args = (struct wait_args *) f->esp;
+        f->eax=process_wait(args->pid);
+        break;
+      }
+    case SYS_FORK:
+      {
+        f->eax=process_fork(f);
+        break;
+      }
     case SYS_HALT:
       {
         shutdown_power_off();
@@ -199,51 +357,43 @@ syscall_handler (struct intr_frame *f)
           {
             invalid_access();
           }
-        lock_acquire(&file_lock);
         struct file * file_fd= filesys_open(args->file);
         if (!file_fd) {
-          lock_release(&file_lock);
             f->eax=-1;
             break;
         }
-        struct oFiles_elem* oe=palloc_get_page(PAL_USER);
+        struct oFiles_elem* oe=kmem_cache_alloc(oFiles_cache);
+        if (!oe) {
+          /* out of kernel memory, fail the open */
+          file_close(file_fd);
+          f->eax=-1;
+          break;
+        }
         oe->file_fd=file_fd;
+        oe->ref_cnt=1;
+        lock_acquire(&fd_lock);
         oe->num_fd=numOpenFiles+3;//does no reclaimation. 0,1,2 are for stdin, stdout, stderr so start from 3
         list_push_back(&oFiles,&(oe->elem) );
-        lock_release(&file_lock);
-        // oe.
         numOpenFiles++;
+        lock_release(&fd_lock);
         f->eax=oe->num_fd;
         break;
       }
     case SYS_CLOSE:
       {
         struct close_args *args = (struct close_args *) f->esp;
-        struct list_elem *e;
-        struct file *file_fd;
-        int found_file=0;
         struct oFiles_elem *fof;
-        for (e = list_begin (&oFiles); e != list_end (&oFiles);
-             e = list_next (e))
-          {
-            // printf("196\n");
-            fof = list_entry (e, struct oFiles_elem, elem);
-            if (fof->num_fd==args->fd) {
-              file_fd=fof->file_fd;
-              found_file=1;
-              break;
-            }
-          }
-        if(found_file==0)
+        lock_acquire(&fd_lock);
+        fof = find_fd(args->fd);
+        if(fof == NULL)
         {
+          lock_release(&fd_lock);
           printf("Error Trying to close a file which might not be open. could not find file descriptor. exiting\n" );
           my_exit();
         }
-        lock_acquire(&file_lock);
-        file_close(file_fd);
         list_remove(&(fof->elem));
-        palloc_free_page(fof);
-        lock_release(&file_lock);
+        lock_release(&fd_lock);
+        release_fd(fof); /* oFiles' reference; calls in progress keep theirs */
         break;
       }
     case SYS_READ:
@@ -253,7 +403,6 @@ syscall_handler (struct intr_frame *f)
           printf("Invalid access in sys call read. Exiting\n");
           invalid_access();
         }
-        lock_acquire(&file_lock);
         if (args->fd==STDIN_FILENO)
         {
           void *buffer=args->buffer;
@@ -263,39 +412,22 @@ syscall_handler (struct intr_frame *f)
             {
               //some error
               printf("Error in taking input from console exiting\n" );
-              lock_release(&file_lock);
               my_exit();
             }
           }
-          lock_release(&file_lock);
           f->eax=args->size;
           break;
         }
-        struct list_elem *e;
-        struct file *file_fd;
-        int found_file=0;
-        for (e = list_begin (&oFiles); e != list_end (&oFiles);
-             e = list_next (e))
-          {
-            // printf("196\n");
-            struct oFiles_elem *fof = list_entry (e, struct oFiles_elem, elem);
-            if (fof->num_fd==args->fd) {
-              file_fd=fof->file_fd;
-              found_file=1;
-              break;
-            }
-          }
-        if(found_file==0)
-        {
-          // printf("Error Trying to read a file which might not be open. could not find file descriptor. exiting\n" );
-          // my_exit();
+        struct oFiles_elem *fof = lookup_fd(args->fd);
+        if(fof == NULL)
           f->eax=-1;
+        else {
+          bool bad;
+          f->eax=read_to_user(fof->file_fd,args->buffer, args->size, &bad);
+          release_fd(fof);
+          if (bad)
+            invalid_access();
         }
-        else
-        {
-          f->eax=file_read(file_fd,args->buffer, args->size);
-        }
-        lock_release(&file_lock);
         break;
       }
     case SYS_REMOVE:
@@ -305,11 +437,70 @@ syscall_handler (struct intr_frame *f)
             printf("Invalid access in sys call remove. Exiting\n");
             invalid_access();
           }
-          lock_acquire(&file_lock);
           f->eax=filesys_remove(args->file);
-          lock_release(&file_lock);
           break;
         }
+    case SYS_MKDIR:
+    case SYS_CHDIR:
+      {
+        struct open_args *args = (struct open_args *) f->esp;
+        if (!validate_user_addr_range(args->file,1,f->esp,false))
+          invalid_access();
+        if (*NUMBER == SYS_MKDIR)
+          f->eax=filesys_mkdir(args->file);
+        else
+          f->eax=filesys_chdir(args->file);
+        break;
+      }
+    case SYS_READDIR:
+      {
+        struct readdir_args *args = (struct readdir_args *) f->esp;
+        char name[NAME_MAX + 1];
+        struct oFiles_elem *fof;
+        struct file *file_fd;
+        if (!validate_user_addr_range((uint8_t *) args->name, NAME_MAX + 1,
+                                      f->esp, true))
+          invalid_access();
+        fof = lookup_fd(args->fd);
+        file_fd = fof != NULL ? fof->file_fd : NULL;
+        f->eax = false;
+        if (file_fd != NULL && inode_is_dir (file_get_inode (file_fd)))
+          {
+            /* the descriptor's file position is the readdir position */
+            struct dir *dir = dir_open (inode_reopen (file_get_inode (file_fd)));
+            if (dir != NULL)
+              {
+                dir_seek (dir, file_tell (file_fd));
+                f->eax = dir_readdir (dir, name);
+                file_seek (file_fd, dir_tell (dir));
+                dir_close (dir);
+              }
+          }
+        if (fof != NULL)
+          release_fd(fof);
+        if (f->eax)
+          for (size_t i = 0; i <= strlen (name); i++)
+            if (!put_user ((uint8_t *) args->name + i, name[i]))
+              invalid_access();
+        break;
+      }
+    case SYS_ISDIR:
+    case SYS_INUMBER:
+      {
+        struct fd_args *args = (struct fd_args *) f->esp;
+        struct oFiles_elem *fof;
+        fof = lookup_fd(args->fd);
+        if (fof == NULL)
+          f->eax = *NUMBER == SYS_ISDIR ? false : -1;
+        else {
+          if (*NUMBER == SYS_ISDIR)
+            f->eax = inode_is_dir (file_get_inode (fof->file_fd));
+          else
+            f->eax = inode_get_inumber (file_get_inode (fof->file_fd));
+          release_fd(fof);
+        }
+        break;
+      }
     default:
     {
         printf("System calls not implemented.\n");
@@ -321,9 +512,9 @@ syscall_handler (struct intr_frame *f)
 
 static void invalid_access()
 {
-  if (lock_held_by_current_thread(&file_lock))
+  if (lock_held_by_current_thread(&fd_lock))
   {
-    lock_release(&file_lock);
+    lock_release(&fd_lock);
   }
   my_exit();
 }
@@ -1,10 +1,49 @@
 #include "vm/frame.h"
 #include "vm/sup_page.h"
+#include "vm/swap.h"
+#include <stdio.h>
+#include <string.h>
 #include "bitmap.h"
-#include "threads/malloc.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/pressure.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+#include "userprog/exception.h"
 #include "userprog/pagedir.h"
 
 static struct frame_table ft;
+static struct kmem_cache* frame_cache;
+static struct kmem_cache* mapping_cache;
+
+/* Working sets are sampled from the timer interrupt: every WS_INTERVAL
+   ticks the accessed bits of each frame are shifted into its age. A
+   page referenced in the last two samples is in the working set. */
+#define WS_INTERVAL (TIMER_FREQ / 10)
+#define WS_RECENT 0xc0
+
+/* Page-fault-frequency control of the resident-set limits: more than
+   PFF_HIGH faults in a sample window raise the limit by half, fewer
+   than PFF_LOW lower it by PFF_STEP pages, down to the working set. */
+#define PFF_HIGH 8
+#define PFF_LOW 2
+#define PFF_STEP 8
+
+/* Hard per-process limit, kernel option -rss. */
+size_t frame_rss_max = SIZE_MAX;
+/* Print the resident set of each process at exit, option -vmstats. */
+bool frame_ws_stats;
+
+static unsigned ws_ticks; /* ticks since the last sample */
+
+static long long evict_cnt;       /* frames taken away */
+static long long evict_local_cnt; /* of those, from the faulting process */
+static long long swap_out_cnt;
+static long long swap_in_cnt;
+
+/* Shared by every zero-fill page that has been read but not written.
+   It is not in the frame table - never evicted, never freed. */
+static void* zero_frame;
 
 /* helper */
 static struct frame* find_frame_by_no(unsigned fn) {
@@ -16,29 +55,392 @@ static struct frame* find_frame_by_no(unsigned fn) {
   return NULL;
 }
 
+/* page cache hash on (inode, offset, length) */
+static unsigned frame_cache_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct frame* f = hash_entry(e, struct frame, cache_elem);
+  return hash_int((int)f->inode) ^ hash_int(f->offset) ^ f->read_bytes;
+}
+
+static bool frame_cache_less(const struct hash_elem* a,
+                             const struct hash_elem* b, void* aux UNUSED) {
+  const struct frame* fa = hash_entry(a, struct frame, cache_elem);
+  const struct frame* fb = hash_entry(b, struct frame, cache_elem);
+  if(fa->inode != fb->inode) return fa->inode < fb->inode;
+  if(fa->offset != fb->offset) return fa->offset < fb->offset;
+  return fa->read_bytes < fb->read_bytes;
+}
+
+/* helper - looks up a cached frame, ft.mutex must be held */
+static struct frame* frame_cache_find(struct inode* inode, off_t offs,
+                                      uint32_t read_bytes) {
+  struct frame key;
+  key.inode = inode;
+  key.offset = offs;
+  key.read_bytes = read_bytes;
+  struct hash_elem* he = hash_find(&ft.page_cache, &key.cache_elem);
+  return he ? hash_entry(he, struct frame, cache_elem) : NULL;
+}
+
+/* helper - records that the current thread maps VA to F */
+static bool frame_add_mapping(struct frame* f, void* va) {
+  struct frame_mapping* m =
+    (struct frame_mapping*)kmem_cache_alloc(mapping_cache);
+  if(m == NULL)
+    return false;
+  m->owner = thread_current();
+  m->upage = ADDR_TO_PFNO(va);
+  m->prefetched = 0;
+  list_push_back(&f->mappings, &m->elem);
+  f->share_cnt++;
+  if(++m->owner->rss > m->owner->rss_peak)
+    m->owner->rss_peak = m->owner->rss;
+  return true;
+}
+
+/* helper - a prefetched page was used: counts it, once. The flag
+   stays with the mapping, so neither the sampler clearing the
+   accessed bits nor an eviction can lose the use. */
+static void frame_note_use(struct frame_mapping* m) {
+  if(m->prefetched) {
+    m->prefetched = 0;
+    exception_count_prefetch_use();
+  }
+}
+
+/* helper - frees mapping M, which is off its frame's list. An
+   accessed bit not sampled yet still counts; clearing the PTE keeps
+   it. */
+static void frame_free_mapping(struct frame_mapping* m) {
+  if(m->prefetched && m->owner->pagedir != NULL
+     && pagedir_is_accessed(m->owner->pagedir, PFNO_TO_ADDR(m->upage)))
+    frame_note_use(m);
+  m->owner->rss--;
+  kmem_cache_free(mapping_cache, m);
+}
+
+/* helper - finds OWNER's mapping of VA to F, or NULL */
+static struct frame_mapping* frame_find_mapping(struct frame* f,
+                                                struct thread* owner,
+                                                void* va) {
+  struct list_elem* e;
+  for(e=list_begin(&f->mappings); e!=list_end(&f->mappings); e=list_next(e)) {
+    struct frame_mapping* m = list_entry(e, struct frame_mapping, elem);
+    if(m->owner == owner && m->upage == ADDR_TO_PFNO(va))
+      return m;
+  }
+  return NULL;
+}
+
+/* helper - forgets that OWNER maps VA to F */
+static void frame_drop_mapping(struct frame* f, struct thread* owner, void* va) {
+  struct frame_mapping* m = frame_find_mapping(f, owner, va);
+  if(m != NULL) {
+    list_remove(&m->elem);
+    frame_free_mapping(m);
+    f->share_cnt--;
+  }
+}
+
+/* helper - removes F from the table and gives its page back */
+static void frame_release(struct frame* f) {
+  while(!list_empty(&f->mappings)) {
+    struct list_elem* e = list_pop_front(&f->mappings);
+    frame_free_mapping(list_entry(e, struct frame_mapping, elem));
+  }
+  if(f->inode)
+    hash_delete(&ft.page_cache, &f->cache_elem);
+  if(ft.hand == &f->elem)
+    ft.hand = list_next(ft.hand);
+  list_remove(&f->elem);
+  ft.count--;
+  palloc_free_page(PFNO_TO_ADDR(f->kpage));
+  kmem_cache_free(frame_cache, f);
+}
+
+/* Reverse map: f->mappings lists every (owner, upage) that maps F,
+   the PTE being in the owner's pagedir. The helpers below act on all
+   of them in one pass. ft.mutex must be held (frame_tick only walks
+   the lists while nobody holds it), which also keeps each owner's
+   pagedir alive: an owner drops its mappings in frame_forget, under
+   ft.mutex, before its pagedir is destroyed. */
+
+/* helper - rmap: true if any sharer touched F since the last sweep;
+   clears the accessed bits for the next one. Interrupts are off
+   between the test and the clear, or an access by an owner that got
+   to run in between would be lost. */
+static bool frame_rmap_accessed(struct frame* f) {
+  bool accessed = false;
+  struct list_elem* e;
+  enum intr_level old = intr_disable();
+  for(e=list_begin(&f->mappings); e!=list_end(&f->mappings); e=list_next(e)) {
+    struct frame_mapping* m = list_entry(e, struct frame_mapping, elem);
+    void* upage = PFNO_TO_ADDR(m->upage);
+    if(m->owner->pagedir != NULL
+       && pagedir_is_accessed(m->owner->pagedir, upage)) {
+      accessed = true;
+      frame_note_use(m);
+      pagedir_set_accessed(m->owner->pagedir, upage, false);
+    }
+  }
+  intr_set_level(old);
+  return accessed;
+}
+
+/* helper - rmap: true if any sharer wrote F. Copy-on-write sharers
+   inherit the dirty bit at fork, so a clean frame still matches what
+   its pages were loaded from. */
+static bool frame_rmap_dirty(struct frame* f) {
+  struct list_elem* e;
+  for(e=list_begin(&f->mappings); e!=list_end(&f->mappings); e=list_next(e)) {
+    struct frame_mapping* m = list_entry(e, struct frame_mapping, elem);
+    if(m->owner->pagedir != NULL
+       && pagedir_is_dirty(m->owner->pagedir, PFNO_TO_ADDR(m->upage)))
+      return true;
+  }
+  return false;
+}
+
+/* helper - rmap: removes F from every address space that maps it.
+   The mappings themselves stay until frame_release. */
+static void frame_rmap_unmap(struct frame* f) {
+  struct list_elem* e;
+  for(e=list_begin(&f->mappings); e!=list_end(&f->mappings); e=list_next(e)) {
+    struct frame_mapping* m = list_entry(e, struct frame_mapping, elem);
+    if(m->owner->pagedir != NULL)
+      pagedir_clear_page(m->owner->pagedir, PFNO_TO_ADDR(m->upage));
+  }
+}
+
+/* helper - the page of M's owner that F backs, if it is installed
+   and settled so that F can be taken away. Interrupts must be off -
+   the owner's page table is walked. */
+static struct sup_page* frame_mapped_page(struct frame* f,
+                                          struct frame_mapping* m) {
+  void* upage = PFNO_TO_ADDR(m->upage);
+  if(m->owner->pagedir == NULL
+     || pagedir_get_page(m->owner->pagedir, upage) != PFNO_TO_ADDR(f->kpage))
+    return NULL;
+  struct sup_page* spg = sup_page_lookup(m->owner, upage);
+  if(spg == NULL || !(spg->location & MEMORY) || spg->frame_no != f->kpage)
+    return NULL;
+  return spg;
+}
+
+/* helper - unmaps F from everyone and frees it. Cached executable
+   pages and clean pages go back to DISK, also when shared
+   copy-on-write. A dirty private page goes to SWAP, a dirty shared
+   one stays. Returns false if F is busy. ft.mutex must be held. */
+static bool frame_page_out(struct frame* f) {
+  struct list_elem* e;
+  /* the owners must not see a page missing and still in MEMORY */
+  enum intr_level old = intr_disable();
+  for(e=list_begin(&f->mappings); e!=list_end(&f->mappings); e=list_next(e))
+    if(frame_mapped_page(f, list_entry(e, struct frame_mapping, elem)) == NULL) {
+      intr_set_level(old);
+      return false;
+    }
+
+  if(f->inode != NULL || !frame_rmap_dirty(f)) {
+    /* same as in the executable, or still all zeros */
+    for(e=list_begin(&f->mappings); e!=list_end(&f->mappings); e=list_next(e)) {
+      struct sup_page* spg =
+        frame_mapped_page(f, list_entry(e, struct frame_mapping, elem));
+      spg->location = DISK;
+      spg->frame_no = 0;
+      spg->cow = false;
+    }
+    frame_rmap_unmap(f);
+    intr_set_level(old);
+    frame_release(f);
+    evict_cnt++;
+    return true;
+  }
+  if(f->share_cnt > 1) {
+    /* one swap slot cannot back several pages */
+    intr_set_level(old);
+    return false;
+  }
+
+  struct frame_mapping* m = list_entry(list_front(&f->mappings),
+                                       struct frame_mapping, elem);
+  struct sup_page* spg = frame_mapped_page(f, m);
+  uint32_t* pd = m->owner->pagedir;
+  void* upage = PFNO_TO_ADDR(m->upage);
+  frame_rmap_unmap(f);
+  spg->frame_no = 0;
+  spg->cow = false;
+  /* the owner faulting meanwhile waits for ft.mutex in frame_swap_in */
+  spg->location = SWAP;
+  intr_set_level(old);
+  size_t idx = swap_out(PFNO_TO_ADDR(f->kpage));
+  if(idx == BITMAP_ERROR) {
+    /* no swap space, give the page back */
+    old = intr_disable();
+    pagedir_set_page(pd, upage, PFNO_TO_ADDR(f->kpage), spg->writable);
+    pagedir_set_dirty(pd, upage, true);
+    spg->location = MEMORY;
+    spg->frame_no = f->kpage;
+    intr_set_level(old);
+    return false;
+  }
+  spg->swap_idx = idx;
+  frame_release(f);
+  evict_cnt++;
+  swap_out_cnt++;
+  return true;
+}
+
+/* Evicts one frame, using the clock algorithm on the frame ages kept
+   by the working-set sampler. With OWNER, only frames mapped by OWNER
+   alone are considered: local replacement. Frames shared
+   copy-on-write are evicted only while clean. Returns false if there
+   is nothing
+   that can be evicted. ft.mutex must be held. */
+static bool frame_evict(struct thread* owner) {
+  size_t n;
+  /* an age decays in 8 visits, a third sweep may only clear bits */
+  for(n = 0; n < 10 * ft.count; n++) {
+    if(ft.hand == NULL || ft.hand == list_end(&ft.allframes))
+      ft.hand = list_begin(&ft.allframes);
+    if(ft.hand == list_end(&ft.allframes))
+      return false;
+    struct frame* f = list_entry(ft.hand, struct frame, elem);
+    ft.hand = list_next(ft.hand);
+    if(f->share_cnt == 0)
+      continue;
+    if(owner != NULL && (f->share_cnt > 1 || list_entry(list_front(&f->mappings),
+                           struct frame_mapping, elem)->owner != owner))
+      continue;
+    if(frame_rmap_accessed(f)) {
+      f->age |= 0x80;
+      continue;
+    }
+    if(f->age) {
+      f->age >>= 1;
+      continue;
+    }
+    if(frame_page_out(f)) {
+      if(owner == thread_current())
+        evict_local_cnt++;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* helper - finds the process most above its resident-set limit, or
+   failing that most above its working set */
+static void frame_pick_victim(struct thread* t, void* aux) {
+  struct thread** best = aux;
+  if(t->pagedir == NULL || t->rss == 0)
+    return;
+  size_t over = t->rss > t->rss_limit ? t->rss - t->rss_limit : 0;
+  size_t best_over = (*best == NULL || (*best)->rss <= (*best)->rss_limit) ? 0
+                     : (*best)->rss - (*best)->rss_limit;
+  if(over > best_over
+     || (over == 0 && best_over == 0 && t->rss > t->wss
+         && (*best == NULL || t->rss - t->wss > (*best)->rss - (*best)->wss)))
+    *best = t;
+}
+
+/* helper - makes room when memory is out. The faulting process pays
+   first if it is over its limit, then the process most over its own,
+   so that one thrashing process cannot push out everybody else. */
+static bool frame_evict_global(void) {
+  struct thread* cur = thread_current();
+  struct thread* victim = NULL;
+  if(cur->pagedir != NULL && cur->rss > cur->rss_limit && frame_evict(cur))
+    return true;
+  enum intr_level old = intr_disable();
+  thread_foreach(frame_pick_victim, &victim);
+  intr_set_level(old);
+  if(victim != NULL && frame_evict(victim))
+    return true;
+  return frame_evict(NULL);
+}
+
+/* helper - shrinker, the reclaimer thread evicting ahead of need */
+static size_t frame_shrink(size_t nr) {
+  size_t freed = 0;
+  lock_acquire(&ft.mutex);
+  while(freed < nr && frame_evict_global())
+    freed++;
+  lock_release(&ft.mutex);
+  return freed;
+}
+
+static struct shrinker frame_shrinker = {
+  .name = "frames", .shrink = frame_shrink, .user = true
+};
+
 void frame_table_init(void) {
   ft.count = 0;
   list_init(&ft.allframes);
   lock_init(&ft.mutex);
+  hash_init(&ft.page_cache, frame_cache_hash, frame_cache_less, NULL);
+  ft.hand = NULL;
+  frame_cache = kmem_cache_create("frame", sizeof(struct frame), NULL);
+  mapping_cache = kmem_cache_create("frame_mapping",
+                                    sizeof(struct frame_mapping), NULL);
+  zero_frame = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+  shrinker_register(&frame_shrinker);
 }
 
-void* frame_map(void* va, enum palloc_flags flags) {
+/* helper - frame_map with ft.mutex already held. Without EVICT,
+   returns NULL instead of making room. */
+static void* frame_alloc(void* va, enum palloc_flags flags, bool evict) {
   struct frame* f = NULL;
-  lock_acquire(&ft.mutex);
+  struct thread* cur = thread_current();
+  /* at its hard limit a process replaces its own pages */
+  if(cur->rss >= frame_rss_max) {
+    if(!evict)
+      return NULL;
+    frame_evict(cur);
+  }
   void* pa = palloc_get_page(flags);
+  while(!pa && evict && frame_evict_global())
+    pa = palloc_get_page(flags);
   if(!pa) {
-    /* no free frames. should evict */
-    PANIC("No free frames!");
+    /* nothing left to evict, the caller fails the fault */
+    return NULL;
   } else {
-    f = (struct frame*)malloc(sizeof(struct frame));
+    f = (struct frame*)kmem_cache_alloc(frame_cache);
   }
   if(f) {
     f->kpage = ADDR_TO_PFNO(pa);
-    f->upage = ADDR_TO_PFNO(va);
-    f->owner = thread_current();
+    f->age = 0;
+    f->share_cnt = 0;
+    f->inode = NULL;
+    f->offset = 0;
+    f->read_bytes = 0;
+    list_init(&f->mappings);
     list_push_back(&ft.allframes, &f->elem);
     ft.count++;
+    if(!frame_add_mapping(f, va)) {
+      frame_release(f);
+      pa = NULL;
+    }
+  } else {
+    palloc_free_page(pa);
+    pa = NULL;
   }
+  return pa;
+}
+
+void* frame_map(void* va, enum palloc_flags flags) {
+  lock_acquire(&ft.mutex);
+  void* pa = frame_alloc(va, flags, true);
+  lock_release(&ft.mutex);
+  return pa;
+}
+
+/* Like frame_map, but only takes a free frame - never evicts, and
+   not at all while the user pool is short. For speculative loads. */
+void* frame_try_map(void* va, enum palloc_flags flags) {
+  if(palloc_pressure(PAL_USER) != PRESSURE_NONE)
+    return NULL;
+  lock_acquire(&ft.mutex);
+  void* pa = frame_alloc(va, flags, false);
   lock_release(&ft.mutex);
   return pa;
 }
@@ -47,9 +449,310 @@ void frame_free(void* pa) {
   lock_acquire(&ft.mutex);
   struct frame* f=find_frame_by_no(ADDR_TO_PFNO(pa));
   if(f) { /* frame found */
-    palloc_free_page(PFNO_TO_ADDR(f->kpage));
-    list_remove(&f->elem);
-    free(f);
+    frame_release(f);
+  }
+  lock_release(&ft.mutex);
+}
+
+/* Drops the current thread's mapping of VA to frame PA. The frame
+   is freed once nobody maps it anymore. The PTE must be cleared
+   by the caller. */
+void frame_unmap(void* pa, void* va) {
+  lock_acquire(&ft.mutex);
+  struct frame* f=find_frame_by_no(ADDR_TO_PFNO(pa));
+  if(f) {
+    frame_drop_mapping(f, thread_current(), va);
+    if(f->share_cnt == 0)
+      frame_release(f);
+  }
+  lock_release(&ft.mutex);
+}
+
+/* helper - installs F for SPG in the current process, ft.mutex held.
+   On failure the mapping added for SPG is dropped again. */
+static void* frame_install_shared(struct frame* f, struct sup_page* spg) {
+  void* upage = PFNO_TO_ADDR(spg->page_no);
+  void* kpage = PFNO_TO_ADDR(f->kpage);
+  if(!pagedir_set_page(thread_current()->pagedir, upage, kpage, false)) {
+    frame_drop_mapping(f, thread_current(), upage);
+    return NULL;
+  }
+  spg->location = MEMORY;
+  spg->frame_no = f->kpage;
+  return kpage;
+}
+
+/* Maps the cached copy of the read-only page at OFFS in INODE for
+   SPG, if some process has it loaded already. Returns the kernel
+   address of the shared frame, or NULL on a cache miss. */
+void* frame_share(struct inode* inode, off_t offs, struct sup_page* spg) {
+  void* kpage = NULL;
+  lock_acquire(&ft.mutex);
+  struct frame* f = frame_cache_find(inode, offs, spg->read_bytes);
+  if(f && frame_add_mapping(f, PFNO_TO_ADDR(spg->page_no)))
+    kpage = frame_install_shared(f, spg);
+  lock_release(&ft.mutex);
+  return kpage;
+}
+
+/* Enters PA, a frame from frame_map just filled with the page at OFFS
+   in INODE, into the page cache and installs it read-only for SPG.
+   If another process cached the same page meanwhile, PA is freed and
+   that frame is used instead. Returns the installed frame or NULL. */
+void* frame_publish(void* pa, struct inode* inode, off_t offs,
+                    struct sup_page* spg) {
+  void* kpage = NULL;
+  lock_acquire(&ft.mutex);
+  struct frame* f = find_frame_by_no(ADDR_TO_PFNO(pa));
+  ASSERT(f != NULL && f->share_cnt == 1);
+  struct frame* cached = frame_cache_find(inode, offs, spg->read_bytes);
+  if(cached) {
+    /* lost the race, use the other copy */
+    frame_release(f);
+    if(frame_add_mapping(cached, PFNO_TO_ADDR(spg->page_no)))
+      kpage = frame_install_shared(cached, spg);
+  } else {
+    f->inode = inode;
+    f->offset = offs;
+    f->read_bytes = spg->read_bytes;
+    hash_insert(&ft.page_cache, &f->cache_elem);
+    kpage = frame_install_shared(f, spg);
+    if(kpage == NULL)
+      frame_release(f);
+  }
+  lock_release(&ft.mutex);
+  return kpage;
+}
+
+/* Shares the frame behind page PSPG of PARENT with the current
+   process, which is being forked from it, as page SPG. Writable
+   pages become copy-on-write in both processes. Pages not in
+   memory are simply loaded again by the child. */
+bool frame_fork_page(struct thread* parent, struct sup_page* pspg,
+                     struct sup_page* spg) {
+  bool ok = true;
+  lock_acquire(&ft.mutex);
+  spg->location = pspg->location;
+  spg->frame_no = 0;
+  if((pspg->location & MEMORY) && pspg->frame_no == ADDR_TO_PFNO(zero_frame)) {
+    ok = pagedir_set_page(thread_current()->pagedir,
+                          PFNO_TO_ADDR(pspg->page_no), zero_frame, false);
+    if(ok) {
+      spg->frame_no = pspg->frame_no;
+      spg->cow = pspg->cow;
+    }
+  } else if((pspg->location & MEMORY) && pspg->frame_no != 0) {
+    struct frame* f = find_frame_by_no(pspg->frame_no);
+    void* upage = PFNO_TO_ADDR(pspg->page_no);
+    ASSERT(f != NULL);
+    ok = frame_add_mapping(f, upage);
+    if(ok) {
+      if(pspg->writable) {
+        pagedir_set_writable(parent->pagedir, upage, false);
+        pspg->cow = spg->cow = true;
+      }
+      ok = pagedir_set_page(thread_current()->pagedir, upage,
+                            PFNO_TO_ADDR(f->kpage), false);
+      if(ok) {
+        spg->frame_no = f->kpage;
+        /* differs from the executable, must not be dropped as clean */
+        if(pagedir_is_dirty(parent->pagedir, upage))
+          pagedir_set_dirty(thread_current()->pagedir, upage, true);
+      } else
+        frame_drop_mapping(f, thread_current(), upage);
+    }
+  } else if(pspg->location & SWAP) {
+    /* swapped out pages are copied right away */
+    void* upage = PFNO_TO_ADDR(pspg->page_no);
+    void* pa = frame_alloc(upage, PAL_USER, true);
+    ok = pa != NULL && swap_in(pspg->swap_idx, pa)
+         && pagedir_set_page(thread_current()->pagedir, upage, pa,
+                             pspg->writable);
+    if(ok) {
+      pagedir_set_dirty(thread_current()->pagedir, upage, true);
+      spg->location = MEMORY;
+      spg->frame_no = ADDR_TO_PFNO(pa);
+    } else {
+      spg->location = 0;
+      if(pa != NULL)
+        frame_release(find_frame_by_no(ADDR_TO_PFNO(pa)));
+    }
+  }
+  lock_release(&ft.mutex);
+  return ok;
+}
+
+/* Resolves a write fault on copy-on-write page SPG of the current
+   process. The last sharer just gets write access back, the others
+   get a private copy of the frame. */
+bool frame_cow_break(struct sup_page* spg) {
+  bool ok = false;
+  uint32_t* pd = thread_current()->pagedir;
+  void* upage = PFNO_TO_ADDR(spg->page_no);
+  lock_acquire(&ft.mutex);
+  struct frame* f = find_frame_by_no(spg->frame_no);
+  ASSERT(spg->cow && (f != NULL || spg->frame_no == ADDR_TO_PFNO(zero_frame)));
+  if(spg->frame_no == ADDR_TO_PFNO(zero_frame)) {
+    /* first write to a zero-fill page */
+    void* pa = frame_alloc(upage, PAL_USER | PAL_ZERO, true);
+    if(pa != NULL) {
+      pagedir_clear_page(pd, upage);
+      ok = pagedir_set_page(pd, upage, pa, true);
+      if(ok)
+        spg->frame_no = ADDR_TO_PFNO(pa);
+    }
+  } else if(f->share_cnt == 1) {
+    pagedir_set_writable(pd, upage, true);
+    ok = true;
+  } else {
+    void* pa = frame_alloc(upage, PAL_USER, true);
+    if(pa != NULL) {
+      memcpy(pa, PFNO_TO_ADDR(f->kpage), PGSIZE);
+      frame_drop_mapping(f, thread_current(), upage);
+      pagedir_clear_page(pd, upage);
+      ok = pagedir_set_page(pd, upage, pa, true);
+      if(ok)
+        spg->frame_no = ADDR_TO_PFNO(pa);
+      /* on failure the page is simply gone, the process is killed */
+    }
   }
+  if(ok)
+    spg->cow = false;
   lock_release(&ft.mutex);
+  return ok;
+}
+
+/* Maps the shared zero frame read-only for zero-fill page SPG of the
+   current process. A writable page gets its own frame on the first
+   write fault, through frame_cow_break. */
+void* frame_map_zero(struct sup_page* spg) {
+  void* upage = PFNO_TO_ADDR(spg->page_no);
+  if(!pagedir_set_page(thread_current()->pagedir, upage, zero_frame, false))
+    return NULL;
+  spg->location = MEMORY;
+  spg->frame_no = ADDR_TO_PFNO(zero_frame);
+  spg->cow = spg->writable;
+  return zero_frame;
+}
+
+/* Brings SWAP page SPG of the current process back into a frame.
+   Returns the frame, NULL if memory is out. */
+void* frame_swap_in(struct sup_page* spg) {
+  uint32_t* pd = thread_current()->pagedir;
+  void* upage = PFNO_TO_ADDR(spg->page_no);
+  void* pa;
+  lock_acquire(&ft.mutex);
+  if(!(spg->location & SWAP)) {
+    /* eviction failed while we waited, the page is back */
+    pa = PFNO_TO_ADDR(spg->frame_no);
+  } else {
+    pa = frame_alloc(upage, PAL_USER, true);
+    if(pa != NULL && swap_in(spg->swap_idx, pa)
+       && pagedir_set_page(pd, upage, pa, spg->writable)) {
+      /* the swap copy goes away, so the page counts as written */
+      pagedir_set_dirty(pd, upage, true);
+      swap_free(spg->swap_idx);
+      spg->location = MEMORY;
+      spg->frame_no = ADDR_TO_PFNO(pa);
+      swap_in_cnt++;
+    } else if(pa != NULL) {
+      frame_release(find_frame_by_no(ADDR_TO_PFNO(pa)));
+      pa = NULL;
+    }
+  }
+  lock_release(&ft.mutex);
+  return pa;
+}
+
+/* Releases what holds page SPG of the current process - its frame
+   or its swap slot. For process exit, once SPG is off the page
+   table so it cannot be evicted anymore. */
+void frame_forget(struct sup_page* spg) {
+  struct thread* cur = thread_current();
+  void* upage = PFNO_TO_ADDR(spg->page_no);
+  lock_acquire(&ft.mutex);
+  if((spg->location & MEMORY) && spg->frame_no != 0) {
+    if(cur->pagedir)
+      pagedir_clear_page(cur->pagedir, upage);
+    struct frame* f = find_frame_by_no(spg->frame_no);
+    if(f) {
+      frame_drop_mapping(f, cur, upage);
+      if(f->share_cnt == 0)
+        frame_release(f);
+    }
+  } else if(spg->location & SWAP)
+    swap_free(spg->swap_idx);
+  lock_release(&ft.mutex);
+}
+
+/* Notes that page SPG of the current process, just mapped, was
+   mapped ahead of a fault on it. Its first use is counted in the
+   fault-around statistics. */
+void frame_mark_prefetched(struct sup_page* spg) {
+  lock_acquire(&ft.mutex);
+  if((spg->location & MEMORY) && spg->frame_no != 0) {
+    struct frame* f = find_frame_by_no(spg->frame_no);
+    struct frame_mapping* m = f ? frame_find_mapping(f, thread_current(),
+                                                     PFNO_TO_ADDR(spg->page_no))
+                                : NULL;
+    if(m)
+      m->prefetched = 1;
+  }
+  lock_release(&ft.mutex);
+}
+
+/* helper - sampler, starts a working-set count */
+static void frame_ws_reset(struct thread* t, void* aux UNUSED) {
+  t->ws_sample = 0;
+}
+
+/* helper - sampler, ends a window: the page-fault-frequency controller */
+static void frame_ws_update(struct thread* t, void* aux UNUSED) {
+  if(t->pagedir == NULL)
+    return;
+  t->wss = t->ws_sample;
+  t->pf_rate = t->pf_window;
+  t->pf_window = 0;
+  if(t->pf_rate > PFF_HIGH) {
+    size_t grow = t->rss_limit / 2 + PFF_STEP;
+    t->rss_limit = t->rss_limit > frame_rss_max - grow ? frame_rss_max
+                                                       : t->rss_limit + grow;
+  } else if(t->pf_rate < PFF_LOW) {
+    size_t floor = t->wss + PFF_STEP > FRAME_RSS_MIN ? t->wss + PFF_STEP
+                                                     : FRAME_RSS_MIN;
+    if(t->rss_limit > floor + PFF_STEP)
+      t->rss_limit -= PFF_STEP;
+    else if(t->rss_limit > floor)
+      t->rss_limit = floor;
+  }
+}
+
+/* Called by the timer interrupt on every tick. Every WS_INTERVAL
+   ticks the accessed bits are sampled into the frame ages and every
+   process gets its working set and fault rate updated. If the frame
+   table is busy, the sample is taken on the next tick. */
+void frame_tick(void) {
+  struct list_elem *e, *me;
+  ASSERT(intr_context());
+  if(zero_frame == NULL) /* frame table not set up yet */
+    return;
+  if(++ws_ticks < WS_INTERVAL || ft.mutex.holder != NULL)
+    return;
+  ws_ticks = 0;
+  thread_foreach(frame_ws_reset, NULL);
+  for(e=list_begin(&ft.allframes); e!=list_end(&ft.allframes); e=list_next(e)) {
+    struct frame* f = list_entry(e, struct frame, elem);
+    f->age = (f->age >> 1) | (frame_rmap_accessed(f) ? 0x80 : 0);
+    if(f->age & WS_RECENT)
+      for(me=list_begin(&f->mappings); me!=list_end(&f->mappings); me=list_next(me))
+        list_entry(me, struct frame_mapping, elem)->owner->ws_sample++;
+  }
+  thread_foreach(frame_ws_update, NULL);
+}
+
+/* Prints replacement statistics. */
+void frame_print_stats(void) {
+  printf("Frames: %lld evicted (%lld by local replacement), "
+         "%lld swapped out, %lld swapped in\n",
+         evict_cnt, evict_local_cnt, swap_out_cnt, swap_in_cnt);
 }
@@ -2,17 +2,40 @@
 #define VM_FRAME_H
 
 #include <list.h>
+#include <hash.h>
 #include "threads/thread.h"
 #include "threads/synch.h"
 #include "threads/palloc.h"
+#include "filesys/off_t.h"
 
 #define ADDR_TO_PFNO(a) (((unsigned)(a))>>12)
 #define PFNO_TO_ADDR(n) ((void*)((n)<<12))
 
-struct frame {
+struct inode;
+struct sup_page;
+
+/* One user page mapped to a frame, an entry of the frame's reverse
+   map. A frame holding a read-only executable page, or a page shared
+   copy-on-write after fork, is mapped by several processes at once. */
+struct frame_mapping {
   struct thread* owner;
-  unsigned kpage:20; /* frame number, physical address same as kernel address */
   unsigned upage:20; /* page number, virtual number same as user address */
+  unsigned prefetched:1; /* mapped ahead of a fault, not seen used yet */
+  struct list_elem elem;
+};
+
+struct frame {
+  unsigned kpage:20; /* frame number, physical address same as kernel address */
+  uint8_t age; /* accessed bit of the last samples, newest highest */
+  unsigned share_cnt; /* number of entries in mappings */
+  struct list mappings; /* reverse mappings, struct frame_mapping */
+  /* Page cache key - inode is NULL for private frames. Two segments
+     can start in the same file page, so the length read is part of
+     the key too. */
+  struct inode* inode;
+  off_t offset;
+  uint32_t read_bytes;
+  struct hash_elem cache_elem;
   struct list_elem elem;
 };
 
@@ -20,10 +43,36 @@ struct frame_table {
   struct list allframes;
   size_t count;
   struct lock mutex;
+  /* read-only executable pages, keyed by (inode, offset, length) */
+  struct hash page_cache;
+  struct list_elem* hand; /* clock hand for eviction */
 };
 
+/* Smallest and initial resident-set limit of a process, in pages */
+#define FRAME_RSS_MIN 16
+
+extern size_t frame_rss_max;
+extern bool frame_ws_stats;
+
 void frame_table_init(void);
 void* frame_map(void* va, enum palloc_flags flags);
+void* frame_try_map(void* va, enum palloc_flags flags);
 void frame_free(void* pa);
+void frame_unmap(void* pa, void* va);
+
+void* frame_share(struct inode* inode, off_t offs, struct sup_page* spg);
+void* frame_publish(void* pa, struct inode* inode, off_t offs,
+                    struct sup_page* spg);
+
+bool frame_fork_page(struct thread* parent, struct sup_page* pspg,
+                     struct sup_page* spg);
+bool frame_cow_break(struct sup_page* spg);
+void* frame_map_zero(struct sup_page* spg);
+void* frame_swap_in(struct sup_page* spg);
+void frame_forget(struct sup_page* spg);
+void frame_mark_prefetched(struct sup_page* spg);
+
+void frame_tick(void);
+void frame_print_stats(void);
 
 #endif /* VM_FRAME_H */
@@ -2,20 +2,27 @@
 #include "vm/frame.h"
 #include <string.h>
 #include "threads/vaddr.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "userprog/pagedir.h"
+
+static struct kmem_cache* sup_page_cache;
+
+/* Creates the cache supplemental pages come from. */
+void sup_page_init(void) {
+  sup_page_cache = kmem_cache_create("sup_page", sizeof(struct sup_page), NULL);
+}
 
 /* helper, called by the below two to add a page to the thread list */
 static struct sup_page* new_sup_page(enum page_location l, bool wr,  
                          unsigned pn, unsigned fn, 
                          /* struct file* pf in execfile,*/ off_t offs, uint32_t rd_b,
                          size_t bl_idx) {
-  // does this need a lock? maybe for malloc only
-  struct sup_page* pg = (struct sup_page*)malloc(sizeof(struct sup_page));
+  struct sup_page* pg = (struct sup_page*)kmem_cache_alloc(sup_page_cache);
   if(pg != NULL) {
     *pg = (struct sup_page) {.location = l, .writable = wr, .page_no = pn, .frame_no = fn,
-            .offset = offs, .read_bytes = rd_b};
+            .offset = offs, .read_bytes = rd_b, .swap_idx = bl_idx};
     /* add it to the task page list */
     list_push_back(&thread_current()->sup_page_table, &pg->elem);
   }
@@ -47,8 +54,14 @@ struct sup_page* new_zero_sup_page(uint8_t* upage) {
 
 /* Use to get information about a page during a page_fault */
 struct sup_page* lookup_page(uint8_t* upage) {
+  return sup_page_lookup(thread_current(), upage);
+}
+
+/* Same as lookup_page, but in the page table of thread T.
+   Used by the frame table to update the pages of sharers. */
+struct sup_page* sup_page_lookup(struct thread* t, uint8_t* upage) {
   unsigned want_page_no = ADDR_TO_PFNO(upage);
-  struct list* plst = &thread_current()->sup_page_table; 
+  struct list* plst = &t->sup_page_table;
   struct list_elem *e;
   for (e=list_begin(plst); e!=list_end(plst); e=list_next(e)) {
     struct sup_page *spg = list_entry (e, struct sup_page, elem);
@@ -58,19 +71,37 @@ struct sup_page* lookup_page(uint8_t* upage) {
 }
 
 /* Frees the memory associated with the sup_page_table entries. 
-   Should be called when processes finish.
+   Should be called when processes finish, before the page directory
+   is destroyed - frames may be shared, so they are unmapped here and
+   pagedir_destroy must not free them. Swap slots are freed too.
  */
 void sup_page_table_destroy(void) {
-  struct list* plst = &thread_current()->sup_page_table; 
+  struct thread* cur = thread_current();
+  struct list* plst = &cur->sup_page_table; 
   while (!list_empty (plst)) {
     struct list_elem *e = list_pop_front (plst);
     struct sup_page *spg = list_entry (e, struct sup_page, elem);
-    if(spg->location & MEMORY) { /* present in memory */
-      /* frame_free is already done in the pagedir destroy! */
-    }
+    frame_forget(spg); /* frame or swap slot */
     if(spg->location & DISK) { /* a file is open, close it */
       /* Should be done once. Done using execfile ptr in thread struct */
     }
-    free(spg); 
+    kmem_cache_free(sup_page_cache, spg);
+  }
+}
+
+/* Copies the page table of PARENT into the current thread, for
+   fork. Pages in memory are shared with the parent, writable ones
+   copy-on-write. PARENT must not run meanwhile. */
+bool sup_page_table_fork(struct thread* parent) {
+  struct list* plst = &parent->sup_page_table;
+  struct list_elem *e;
+  for (e=list_begin(plst); e!=list_end(plst); e=list_next(e)) {
+    struct sup_page *pspg = list_entry (e, struct sup_page, elem);
+    struct sup_page* spg = new_sup_page(pspg->location, pspg->writable,
+                                        pspg->page_no, 0, pspg->offset,
+                                        pspg->read_bytes, -1);
+    if(spg == NULL || !frame_fork_page(parent, pspg, spg))
+      return false;
   }
+  return true;
 }
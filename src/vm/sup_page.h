@@ -5,9 +5,13 @@
 #include <stdlib.h>
 #include "filesys/off_t.h"
 
+struct thread;
+
 /* Describes where pages are located. Allow for non-exclusivity -
    non-writable pages could reside on DISK and MEMORY at the same time.
    These should not be swapped out - they exist on DISK already.
+   Writable pages evicted clean go back to DISK as well - they still
+   match the executable, or are all zeros.
  */
 enum page_location {
   MEMORY = 1, /* resides in RAM */
@@ -21,6 +25,7 @@ enum page_location {
 struct sup_page {
   enum page_location location;
   bool writable; /* could be a code page, for instance */
+  bool cow; /* writable, but mapped read-only until the first write */
   unsigned page_no;  /* most sig 20 bits describing the virtual addr */
   /* the following are non-exclusive */
   /* MEMORY */
@@ -29,16 +34,21 @@ struct sup_page {
   off_t offset; /* offset in bytes */
   uint32_t read_bytes; /* number of bytes to read, up to PGSIZE */
   /* the rest will be zeroed */
+  /* SWAP */
+  size_t swap_idx; /* page index in the swap partition */
   /* We'll do this as a list, but a hash table could be better */
   /* A hash table is already provided in "lib/kernel/hash.h,.c"*/
   struct list_elem elem;
 };
 
+void sup_page_init(void);
 struct sup_page* new_file_sup_page(off_t offs, uint32_t rd_b, 
                        uint8_t* upage, bool ro);
 struct sup_page* new_zero_sup_page(uint8_t* upage);
 struct sup_page* lookup_page(uint8_t* upage);
+struct sup_page* sup_page_lookup(struct thread* t, uint8_t* upage);
 void sup_page_table_destroy(void);
+bool sup_page_table_fork(struct thread* parent);
 
 #endif /* VM_SUP_PAGE_H */
 
@@ -1,5 +1,7 @@
 #include "vm/swap.h"
+#include "vm/zswap.h"
 #include "bitmap.h"
+#include "threads/pressure.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "devices/block.h"
@@ -10,6 +12,9 @@ static struct lock swap_lock;
 
 #define SECTORS_PER_PAGE (PGSIZE/BLOCK_SECTOR_SIZE)
 
+static size_t swap_shrink(size_t nr);
+static struct shrinker zswap_shrinker = { .name = "zswap", .shrink = swap_shrink };
+
 /* this must be called at the right time */
 void swap_init() {
   block_print_stats();  
@@ -19,22 +24,40 @@ void swap_init() {
     printf("Swap size is %d pages.\n",npgswp); 
     swap_freemap = bitmap_create(npgswp);
     bitmap_set_all(swap_freemap, true);
+    zswap_init();
+    shrinker_register(&zswap_shrinker);
   }
   lock_init(&swap_lock);
 }
 
-/* returns the index of the swap page storing the given memory page */
+/* helper - writes KPAGE to swap page INDEX, swap_lock held */
+static void swap_write(size_t index, const void* kpage) {
+  block_sector_t swap_offset = index*SECTORS_PER_PAGE;
+  for(block_sector_t i=0;i<SECTORS_PER_PAGE;i++) {
+    block_write(swap_partition, swap_offset+i, kpage+i*BLOCK_SECTOR_SIZE);
+  }
+}
+
+/* helper - shrinker, moves compressed pages out to their slots to
+   give pool pages back to the kernel */
+static size_t swap_shrink(size_t nr) {
+  lock_acquire(&swap_lock);
+  size_t freed = zswap_shrink(nr, swap_write);
+  lock_release(&swap_lock);
+  return freed;
+}
+
+/* returns the index of the swap page storing the given memory page.
+   The page is kept compressed in memory while zswap has room, the
+   swap page is only reserved for it then. */
 size_t swap_out(const void* kpage) {
   size_t index = BITMAP_ERROR;
+  if(swap_freemap == NULL) /* no swap partition */
+    return index;
   lock_acquire(&swap_lock);
   index = bitmap_scan_and_flip(swap_freemap, 0, 1, true);
-  if(index != BITMAP_ERROR) {
-    block_sector_t swap_offset = index*SECTORS_PER_PAGE;
-    for(block_sector_t i=0;i<SECTORS_PER_PAGE;i++) {
-//      printf("swap out %p to %d\n", kpage+i*BLOCK_SECTOR_SIZE, swap_offset+i);
-      block_write(swap_partition, swap_offset+i, kpage+i*BLOCK_SECTOR_SIZE);
-    }
-  }
+  if(index != BITMAP_ERROR && !zswap_store(index, kpage, swap_write))
+    swap_write(index, kpage);
   lock_release(&swap_lock);
   return index;
 }
@@ -44,10 +67,12 @@ bool swap_in(size_t page_index, void* kpage) {
   lock_acquire(&swap_lock);
   if(bitmap_contains(swap_freemap, page_index, 1, false)) {
     /* the swap page contains something (not free) */
-    block_sector_t swap_offset = page_index*SECTORS_PER_PAGE;
-    for(block_sector_t i=0;i<SECTORS_PER_PAGE;i++) {
-//      printf("swap in %d to %p\n", swap_offset+i, kpage+i*BLOCK_SECTOR_SIZE);
-      block_read(swap_partition, swap_offset+i, kpage+i*BLOCK_SECTOR_SIZE);
+    if(!zswap_load(page_index, kpage)) {
+      block_sector_t swap_offset = page_index*SECTORS_PER_PAGE;
+      for(block_sector_t i=0;i<SECTORS_PER_PAGE;i++) {
+//        printf("swap in %d to %p\n", swap_offset+i, kpage+i*BLOCK_SECTOR_SIZE);
+        block_read(swap_partition, swap_offset+i, kpage+i*BLOCK_SECTOR_SIZE);
+      }
     }
     ok = true;
   }
@@ -56,9 +81,10 @@ bool swap_in(size_t page_index, void* kpage) {
 }
 
 void swap_free(size_t page_index) {
-//  lock_acquire(&swap_lock);
-  bitmap_mark(swap_freemap, page_index); // this is already atomic
-//  lock_release(&swap_lock);
+  lock_acquire(&swap_lock);
+  zswap_invalidate(page_index);
+  bitmap_mark(swap_freemap, page_index);
+  lock_release(&swap_lock);
 }
 
 void swap_destroy() {
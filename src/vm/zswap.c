@@ -0,0 +1,370 @@
+#include "vm/zswap.h"
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+
+/* Evicted pages are compressed with a small LZ77 coder and packed two
+   to a pool page, one from each end (like zbud). A page that does not
+   shrink below ZSWAP_MAX_LEN goes to disk directly. When the pool is
+   full, the oldest pages are written back to their swap slots until
+   the new one fits. A page is dropped from the pool when it is loaded
+   again, so the pool holds each page at most once, oldest first.
+   Everything here runs with the swap lock held. */
+
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+/* One compressed page */
+struct zswap_entry {
+  size_t slot; /* swap slot reserved for it */
+  struct zswap_page* zp; /* pool page holding it */
+  unsigned half; /* 0 at the start of zp, 1 at the end */
+  size_t len; /* compressed length */
+  struct hash_elem hash_elem; /* in entries, keyed by slot */
+  struct list_elem lru_elem; /* in lru, oldest first */
+};
+
+/* One pool page, holding up to two entries */
+struct zswap_page {
+  uint8_t* kpage;
+  struct zswap_entry* buddy[2];
+  struct list_elem elem; /* in unbuddied while a half is free */
+};
+
+size_t zswap_max_pages = 32;
+
+static struct hash entries;
+static struct list lru;
+static struct list unbuddied;
+static size_t pool_pages;
+static struct kmem_cache* entry_cache;
+static struct kmem_cache* zpage_cache;
+static uint8_t* zbuf; /* compressor output */
+static uint8_t* bounce; /* decompressed page on writeback */
+
+static long long store_cnt;
+static long long reject_cnt;
+static long long writeback_cnt;
+static long long hit_cnt;
+static long long miss_cnt;
+static long long in_bytes, out_bytes; /* of all pages stored */
+
+/* LZ coder. A sequence is a token - literal count in the high nibble,
+   match length minus LZ_MIN_MATCH in the low one, 15 meaning more
+   length bytes follow - then the literals, then a 2-byte match
+   offset. The last sequence may stop after its literals. */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 10
+
+/* last position + 1 of each hashed 4-byte sequence */
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+/* helper - writes the bytes of a length beyond 15, NULL if out of room */
+static uint8_t* lz_put_len(uint8_t* op, uint8_t* oend, size_t len) {
+  for(; len >= 255; len -= 255) {
+    if(op == oend)
+      return NULL;
+    *op++ = 255;
+  }
+  if(op == oend)
+    return NULL;
+  *op++ = len;
+  return op;
+}
+
+/* helper - writes a sequence, literals only if MLEN is 0 */
+static uint8_t* lz_put_seq(uint8_t* op, uint8_t* oend, const uint8_t* lit,
+                           size_t lit_len, size_t off, size_t mlen) {
+  size_t ml = mlen ? mlen - LZ_MIN_MATCH : 0;
+  if(op == oend)
+    return NULL;
+  uint8_t* token = op++;
+  *token = (lit_len < 15 ? lit_len : 15) << 4 | (ml < 15 ? ml : 15);
+  if(lit_len >= 15 && (op = lz_put_len(op, oend, lit_len - 15)) == NULL)
+    return NULL;
+  if((size_t)(oend - op) < lit_len)
+    return NULL;
+  memcpy(op, lit, lit_len);
+  op += lit_len;
+  if(mlen) {
+    if(oend - op < 2)
+      return NULL;
+    *op++ = off & 0xff;
+    *op++ = off >> 8;
+    if(ml >= 15 && (op = lz_put_len(op, oend, ml - 15)) == NULL)
+      return NULL;
+  }
+  return op;
+}
+
+/* helper - compresses N bytes from IN, N at most 64 kB. Returns the
+   compressed length, 0 if it would exceed MAX. */
+static size_t lz_compress(const uint8_t* in, size_t n, uint8_t* out,
+                          size_t max) {
+  uint8_t* op = out;
+  uint8_t* oend = out + max;
+  size_t pos = 0, anchor = 0;
+  memset(lz_table, 0, sizeof lz_table);
+  while(pos + LZ_MIN_MATCH <= n) {
+    uint32_t seq;
+    memcpy(&seq, in + pos, sizeof seq);
+    unsigned h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    size_t ref = lz_table[h];
+    lz_table[h] = pos + 1;
+    if(ref != 0 && memcmp(in + ref - 1, in + pos, LZ_MIN_MATCH) == 0) {
+      size_t len = LZ_MIN_MATCH;
+      ref--;
+      while(pos + len < n && in[ref + len] == in[pos + len])
+        len++;
+      op = lz_put_seq(op, oend, in + anchor, pos - anchor, pos - ref, len);
+      if(op == NULL)
+        return 0;
+      pos += len;
+      anchor = pos;
+    } else
+      pos++;
+  }
+  if(anchor < n) {
+    op = lz_put_seq(op, oend, in + anchor, n - anchor, 0, 0);
+    if(op == NULL)
+      return 0;
+  }
+  return op - out;
+}
+
+/* helper - reads a length beyond 15 into *LEN, false on bad input */
+static bool lz_get_len(const uint8_t** ip, const uint8_t* iend, size_t* len) {
+  uint8_t b;
+  do {
+    if(*ip == iend)
+      return false;
+    b = *(*ip)++;
+    *len += b;
+  } while(b == 255);
+  return true;
+}
+
+/* helper - decompresses N bytes from IN, which must give exactly
+   OUT_LEN bytes */
+static bool lz_decompress(const uint8_t* in, size_t n, uint8_t* out,
+                          size_t out_len) {
+  const uint8_t* iend = in + n;
+  size_t pos = 0;
+  while(in < iend) {
+    unsigned token = *in++;
+    size_t lit = token >> 4, ml = token & 15;
+    if(lit == 15 && !lz_get_len(&in, iend, &lit))
+      return false;
+    if((size_t)(iend - in) < lit || out_len - pos < lit)
+      return false;
+    memcpy(out + pos, in, lit);
+    in += lit;
+    pos += lit;
+    if(in == iend)
+      break;
+    if(iend - in < 2)
+      return false;
+    size_t off = in[0] | in[1] << 8;
+    in += 2;
+    if(ml == 15 && !lz_get_len(&in, iend, &ml))
+      return false;
+    ml += LZ_MIN_MATCH;
+    if(off == 0 || off > pos || out_len - pos < ml)
+      return false;
+    /* byte by byte - the match may overlap what it produces */
+    for(; ml > 0; ml--, pos++)
+      out[pos] = out[pos - off];
+  }
+  return pos == out_len;
+}
+
+static unsigned zswap_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_int(hash_entry(e, struct zswap_entry, hash_elem)->slot);
+}
+
+static bool zswap_less(const struct hash_elem* a, const struct hash_elem* b,
+                       void* aux UNUSED) {
+  return hash_entry(a, struct zswap_entry, hash_elem)->slot
+         < hash_entry(b, struct zswap_entry, hash_elem)->slot;
+}
+
+void zswap_init(void) {
+  if(zswap_max_pages == 0)
+    return;
+  hash_init(&entries, zswap_hash, zswap_less, NULL);
+  list_init(&lru);
+  list_init(&unbuddied);
+  entry_cache = kmem_cache_create("zswap_entry",
+                                  sizeof(struct zswap_entry), NULL);
+  zpage_cache = kmem_cache_create("zswap_page",
+                                  sizeof(struct zswap_page), NULL);
+  zbuf = palloc_get_page(PAL_ASSERT);
+  bounce = palloc_get_page(PAL_ASSERT);
+  printf("Zswap pool is %zu pages.\n", zswap_max_pages);
+}
+
+/* helper - the compressed data of E */
+static uint8_t* zswap_data(struct zswap_entry* e) {
+  return e->half == 0 ? e->zp->kpage : e->zp->kpage + PGSIZE - e->len;
+}
+
+/* helper - the entry stored for SLOT, or NULL */
+static struct zswap_entry* zswap_find(size_t slot) {
+  struct zswap_entry key;
+  key.slot = slot;
+  struct hash_elem* he = hash_find(&entries, &key.hash_elem);
+  return he ? hash_entry(he, struct zswap_entry, hash_elem) : NULL;
+}
+
+/* helper - a pool page with LEN bytes free in one half, *HALF set to
+   that half. Grows the pool up to its limit. */
+static struct zswap_page* zswap_find_room(size_t len, unsigned* half) {
+  struct list_elem* e;
+  for(e=list_begin(&unbuddied); e!=list_end(&unbuddied); e=list_next(e)) {
+    struct zswap_page* zp = list_entry(e, struct zswap_page, elem);
+    struct zswap_entry* other = zp->buddy[0] ? zp->buddy[0] : zp->buddy[1];
+    if(PGSIZE - other->len >= len) {
+      *half = zp->buddy[0] == NULL ? 0 : 1;
+      return zp;
+    }
+  }
+  /* the pool only grows while the kernel can spare the pages */
+  if(pool_pages >= zswap_max_pages || palloc_pressure(0) == PRESSURE_MIN)
+    return NULL;
+  struct zswap_page* zp = kmem_cache_alloc(zpage_cache);
+  if(zp == NULL)
+    return NULL;
+  zp->kpage = palloc_get_page(0);
+  if(zp->kpage == NULL) {
+    kmem_cache_free(zpage_cache, zp);
+    return NULL;
+  }
+  zp->buddy[0] = zp->buddy[1] = NULL;
+  list_push_back(&unbuddied, &zp->elem);
+  pool_pages++;
+  *half = 0;
+  return zp;
+}
+
+/* helper - drops E, and its pool page once that is empty */
+static void zswap_remove(struct zswap_entry* e) {
+  struct zswap_page* zp = e->zp;
+  bool was_full = zp->buddy[!e->half] != NULL;
+  hash_delete(&entries, &e->hash_elem);
+  list_remove(&e->lru_elem);
+  zp->buddy[e->half] = NULL;
+  kmem_cache_free(entry_cache, e);
+  if(was_full) {
+    list_push_back(&unbuddied, &zp->elem);
+  } else {
+    list_remove(&zp->elem);
+    palloc_free_page(zp->kpage);
+    kmem_cache_free(zpage_cache, zp);
+    pool_pages--;
+  }
+}
+
+/* helper - writes the oldest entry back to disk. False if the pool
+   is empty. */
+static bool zswap_writeback_oldest(zswap_writeback_func* writeback) {
+  if(list_empty(&lru))
+    return false;
+  struct zswap_entry* e = list_entry(list_front(&lru),
+                                     struct zswap_entry, lru_elem);
+  bool ok = lz_decompress(zswap_data(e), e->len, bounce, PGSIZE);
+  ASSERT(ok);
+  writeback(e->slot, bounce);
+  zswap_remove(e);
+  writeback_cnt++;
+  return true;
+}
+
+/* Compresses page KPAGE into the pool under SLOT, making room by
+   writing the oldest pages back through WRITEBACK. Returns false if
+   the page does not compress well or cannot be placed; the caller
+   then writes it to SLOT itself. */
+bool zswap_store(size_t slot, const void* kpage,
+                 zswap_writeback_func* writeback) {
+  if(zbuf == NULL)
+    return false;
+  size_t len = lz_compress(kpage, PGSIZE, zbuf, ZSWAP_MAX_LEN);
+  if(len == 0) {
+    reject_cnt++;
+    return false;
+  }
+  struct zswap_entry* e = kmem_cache_alloc(entry_cache);
+  if(e == NULL)
+    return false;
+  unsigned half;
+  struct zswap_page* zp;
+  while((zp = zswap_find_room(len, &half)) == NULL)
+    if(!zswap_writeback_oldest(writeback)) {
+      kmem_cache_free(entry_cache, e);
+      return false;
+    }
+  e->slot = slot;
+  e->zp = zp;
+  e->half = half;
+  e->len = len;
+  zp->buddy[half] = e;
+  if(zp->buddy[!half] != NULL)
+    list_remove(&zp->elem);
+  memcpy(zswap_data(e), zbuf, len);
+  hash_insert(&entries, &e->hash_elem);
+  list_push_back(&lru, &e->lru_elem);
+  store_cnt++;
+  in_bytes += PGSIZE;
+  out_bytes += len;
+  return true;
+}
+
+/* Writes the oldest pages back through WRITEBACK until NR pool
+   pages are freed or the pool is empty. Returns the pages freed. */
+size_t zswap_shrink(size_t nr, zswap_writeback_func* writeback) {
+  size_t start = pool_pages;
+  if(zbuf == NULL)
+    return 0;
+  while(start - pool_pages < nr && zswap_writeback_oldest(writeback))
+    continue;
+  return start - pool_pages;
+}
+
+/* Fills KPAGE with the page stored under SLOT and drops it from the
+   pool. Returns false if it is not in the pool, but on disk. */
+bool zswap_load(size_t slot, void* kpage) {
+  if(zbuf == NULL)
+    return false;
+  struct zswap_entry* e = zswap_find(slot);
+  if(e == NULL) {
+    miss_cnt++;
+    return false;
+  }
+  bool ok = lz_decompress(zswap_data(e), e->len, kpage, PGSIZE);
+  ASSERT(ok);
+  zswap_remove(e);
+  hit_cnt++;
+  return true;
+}
+
+/* Drops the page stored under SLOT, if any */
+void zswap_invalidate(size_t slot) {
+  if(zbuf == NULL)
+    return;
+  struct zswap_entry* e = zswap_find(slot);
+  if(e != NULL)
+    zswap_remove(e);
+}
+
+/* Prints pool statistics */
+void zswap_print_stats(void) {
+  if(zbuf == NULL)
+    return;
+  printf("Zswap: %lld stored at %lld%% of their size, %lld rejected, "
+         "%lld written back, %lld hits, %lld misses, %zu of %zu pages\n",
+         store_cnt, in_bytes ? out_bytes * 100 / in_bytes : 0, reject_cnt,
+         writeback_cnt, hit_cnt, miss_cnt, pool_pages, zswap_max_pages);
+}
@@ -0,0 +1,25 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Compressed cache in front of the swap partition. Pages are kept
+   under the swap slot reserved for them, so a page written back to
+   disk keeps its slot number. */
+
+/* Writes the page contents of SLOT to the swap partition */
+typedef void zswap_writeback_func(size_t slot, const void* page);
+
+/* Pool size in kernel pages, option -zswap; 0 turns the cache off */
+extern size_t zswap_max_pages;
+
+void zswap_init(void);
+bool zswap_store(size_t slot, const void* kpage,
+                 zswap_writeback_func* writeback);
+bool zswap_load(size_t slot, void* kpage);
+void zswap_invalidate(size_t slot);
+size_t zswap_shrink(size_t nr, zswap_writeback_func* writeback);
+void zswap_print_stats(void);
+
+#endif /* VM_ZSWAP_H */